@@ -1,5 +1,6 @@
 #include <stack-graph-tree.h>
 #include <stack-graph-engine.h>
+#include <file-watcher.h>
 #include <tree_sitter/api.h>
 #include <iostream>
 #include <tuple>
@@ -7,6 +8,10 @@
 #include <json.hpp>
 #include <cstdlib>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 using json = nlohmann::json;
 
@@ -41,6 +46,23 @@ constexpr unsigned int hash(const char *s, int off = 0)
 struct Reactor
 {
     StackGraphEngine engine;
+    string snapshot;
+    string workspace;
+    // Whether the last index asked for a resolution table after linking.
+    bool resolve_eagerly = false;
+
+    // The watcher thread updates the engine while commands are answered:
+    // queries share engine_lock, updates hold it exclusively, and every
+    // response is written under output_lock.
+    std::shared_mutex engine_lock;
+    std::mutex output_lock;
+    std::unique_ptr<stack_graph::FileWatcher> watcher;
+    std::thread watch_thread;
+
+    void emit(const json &res){
+        std::lock_guard<std::mutex> lock(output_lock);
+        std::cout << res.dump() << std::endl;
+    }
 
     void loop()
     {
@@ -55,6 +77,7 @@ struct Reactor
             switch (hash(parsed["command"].get<string>().c_str()))
             {
             case hash("stop"):
+                stop_watching();
                 exit(0);
             case hash("index"):
                 do_index(parsed["payload"]);
@@ -65,21 +88,132 @@ struct Reactor
             case hash("find_usages"):
                 find_usages(parsed["payload"]);
                 break;
+            case hash("include_graph"):
+                include_graph(parsed["payload"]);
+                break;
+            case hash("stats"):
+                stats();
+                break;
+            case hash("save_index"):
+                save_index(parsed["payload"]);
+                break;
+            case hash("load_index"):
+                load_index(parsed["payload"]);
+                break;
+            case hash("did_open"):
+                did_open(parsed["payload"]);
+                break;
+            case hash("did_change"):
+                did_change(parsed["payload"]);
+                break;
+            case hash("did_close"):
+                did_close(parsed["payload"]);
+                break;
             case hash("debug_print_tree"):
                 debug_print_tree(parsed["payload"]);
                 break;
             default:
+                std::lock_guard<std::mutex> lock(output_lock);
                 std::cout << line << std::endl;
             }
         }
     }
 
+    // What an index payload covers; a snapshot is only reused for the same
+    // workspace.
+    string workspace_key(json payload){
+        json key;
+        key["path"] = payload["path"];
+        key["excludes"] = payload["excludes"];
+        if(payload.contains("compile_commands")){
+            key["compile_commands"] = payload["compile_commands"];
+        }
+        return key.dump();
+    }
+
+    // Switches the engine to the payload's compilation database, or back to
+    // indexing whole directories when it names none.
+    bool use_compile_commands(json payload){
+        auto file = payload.value("compile_commands", string());
+        if(engine.useCompileCommands(file)){
+            return true;
+        }
+
+        json res;
+        res["command"] = "index";
+        res["status"] = "error";
+        res["compile_commands"] = file;
+        emit(res);
+        return false;
+    }
+
     void do_index(json payload){
+        // Restarted after indexing so the watcher never waits on this index.
+        if(payload.contains("watch")){
+            stop_watching();
+        }
+
+        {
+            std::unique_lock<std::shared_mutex> lock(engine_lock);
+            index_or_load_snapshot(payload);
+        }
+
+        if(payload.value("watch", false)){
+            start_watching(payload);
+        }
+    }
+
+    // Rebuilds the resolution table when the index asked for one, and adds
+    // what it cost to `res`.
+    void resolve_all(json &res, unsigned int threads){
+        if(!resolve_eagerly){
+            return;
+        }
+
+        auto start = high_resolution_clock::now();
+        engine.resolveAll(threads);
+        auto end = high_resolution_clock::now();
+
+        auto &table = engine.resolutions;
+        res["resolution_time_ms"] = duration_cast<milliseconds>(end-start).count();
+        res["resolved_fraction"] = table.references == 0 ? 0.0 : (double)table.resolved / table.references;
+        res["resolution_table_bytes"] = table.memoryUsage();
+    }
+
+    void index_or_load_snapshot(json payload){
+        workspace = workspace_key(payload);
+        resolve_eagerly = payload.value("resolve_eagerly", false);
+        if(!use_compile_commands(payload)){
+            return;
+        }
+
+        // The snapshot stands in for the first index of a session only; later
+        // index commands scan the directory and reparse what changed. A loaded
+        // snapshot is scanned as well, as its units are not checked against
+        // their files: edited ones are reparsed, removed ones dropped, files
+        // added since indexed and the rest skipped unchanged.
+        const char *snapshot_status = nullptr;
+        if(snapshot != "" && engine.translation_units.empty()){
+            auto result = engine.loadIndex(snapshot, workspace);
+            snapshot_status = stack_graph::snapshotResultName(result);
+        }
+
+        auto changed = index_directory(payload, snapshot_status);
+        if(snapshot != "" && changed){
+            engine.saveIndex(snapshot, workspace);
+        }
+    }
+
+    // Returns whether the scan changed anything.
+    bool index_directory(json payload, const char *snapshot_status){
         string path = payload["path"].get<string>();
         auto excludes = payload["excludes"].get<vector<string>>();
+        auto threads = payload.value("threads", 1u);
+        auto follow_symlinks = payload.value("follow_symlinks", false);
+        engine.builder = payload.value("builder", "cursor") == "recursive" ? stack_graph::RECURSIVE_BUILDER : stack_graph::CURSOR_BUILDER;
         
         auto start = high_resolution_clock::now();
-        engine.loadDirectoryRecursive(path, excludes);
+        auto delta = engine.loadDirectoryRecursive(path, excludes, threads, follow_symlinks);
         auto end = high_resolution_clock::now();
         
         auto duration = duration_cast<milliseconds>(end-start);
@@ -88,11 +222,28 @@ struct Reactor
         res["command"] = "index";
         res["status"] = "done_indexing";
         res["time_ms"] = duration.count();
+        res["bytes_read"] = engine.bytes_read.load();
+        res["bytes_copied"] = engine.bytes_copied.load();
+        res["skipped"] = delta.skipped;
+        res["reparsed"] = delta.reparsed;
+        res["added"] = delta.added;
+        res["removed"] = delta.removed;
+        if(snapshot_status != nullptr){
+            res["snapshot"] = snapshot_status;
+        }
 
-        std::cout << res.dump() << std::endl;
+        emit(res);
+
+        res.erase("bytes_read");
+        res.erase("bytes_copied");
+        res.erase("snapshot");
+        res.erase("skipped");
+        res.erase("reparsed");
+        res.erase("added");
+        res.erase("removed");
 
         start = high_resolution_clock::now();
-        engine.crossLink();
+        auto relinked = engine.crossLink(delta, threads);
         end = high_resolution_clock::now();
         
         duration = duration_cast<milliseconds>(end-start);
@@ -100,19 +251,230 @@ struct Reactor
         res["command"] = "index";
         res["status"] = "done_crosslinking";
         res["time_ms"] = duration.count();
+        res["relinked"] = relinked;
+        resolve_all(res, threads);
 
-        std::cout << res.dump() << std::endl;
+        emit(res);
+        return !delta.empty();
+    }
+
+    void start_watching(json payload){
+        auto path = payload["path"].get<string>();
+        auto excludes = payload["excludes"].get<vector<string>>();
+        auto threads = payload.value("threads", 1u);
+        auto follow_symlinks = payload.value("follow_symlinks", false);
+        auto debounce_ms = payload.value("debounce_ms", 200u);
+
+        auto start = high_resolution_clock::now();
+        watcher = std::make_unique<stack_graph::FileWatcher>(path, excludes, follow_symlinks);
+        auto ok = watcher->start();
+        auto end = high_resolution_clock::now();
+
+        json res;
+        res["command"] = "watch";
+        res["status"] = ok ? "ok" : "error";
+        res["directories"] = watcher->directories.size();
+        res["time_ms"] = duration_cast<milliseconds>(end-start).count();
+        emit(res);
+
+        if(!ok){
+            watcher.reset();
+            return;
+        }
+
+        watch_thread = std::thread([this, threads, follow_symlinks, debounce_ms](){
+            vector<string> batch;
+            while(watcher->nextBatch(batch, debounce_ms)){
+                update_index(batch, threads, follow_symlinks);
+            }
+        });
+    }
+
+    void stop_watching(){
+        if(watcher != nullptr){
+            watcher->stop();
+            watch_thread.join();
+            watcher.reset();
+        }
+    }
+
+    // Re-indexes the files of a watcher batch. Files are read and parsed under
+    // the shared lock, so queries are only held up while the result is merged
+    // and cross-linked.
+    void update_index(const vector<string> &batch, unsigned int threads, bool follow_symlinks){
+        auto start = high_resolution_clock::now();
+
+        stack_graph::IndexScan scan;
+        {
+            std::shared_lock<std::shared_mutex> lock(engine_lock);
+            // Which files a change brings in depends on everyone's includes,
+            // so with a compilation database the whole workspace is scanned;
+            // files that did not change are only stat'ed.
+            if(engine.compile_db.empty()){
+                scan = engine.scanPaths(batch, watcher->filter, threads, follow_symlinks);
+            }
+            else{
+                scan = engine.scanCompileCommands(watcher->root, watcher->filter, threads);
+            }
+        }
+
+        stack_graph::IndexDelta delta;
+        size_t relinked;
+        json resolution;
+        {
+            std::unique_lock<std::shared_mutex> lock(engine_lock);
+            delta = engine.applyScan(scan);
+            relinked = engine.crossLink(delta, threads);
+            if(!delta.empty()){
+                resolve_all(resolution, threads);
+            }
+        }
+
+        auto end = high_resolution_clock::now();
+
+        if(delta.empty()){
+            return;
+        }
+
+        json res;
+        res["command"] = "index_updated";
+        res["status"] = "ok";
+        res["batch"] = batch.size();
+        res["reparsed"] = delta.reparsed;
+        res["added"] = delta.added;
+        res["removed"] = delta.removed;
+        res["relinked"] = relinked;
+        res["time_ms"] = duration_cast<milliseconds>(end-start).count();
+        res.update(resolution);
+        emit(res);
+    }
+
+    void save_index(json payload){
+        std::shared_lock<std::shared_mutex> lock(engine_lock);
+
+        auto file = payload["file"].get<string>();
+
+        auto start = high_resolution_clock::now();
+        auto ok = engine.saveIndex(file, workspace);
+        auto end = high_resolution_clock::now();
+
+        json res;
+        res["command"] = "save_index";
+        res["status"] = ok ? "ok" : "error";
+        res["time_ms"] = duration_cast<milliseconds>(end-start).count();
+
+        emit(res);
+    }
+
+    // Loads a snapshot. When the payload also describes a workspace the way
+    // index does, the snapshot must match it, and a missing, stale or corrupt
+    // snapshot is replaced by a full index that is saved back to `file`.
+    void load_index(json payload){
+        std::unique_lock<std::shared_mutex> lock(engine_lock);
+
+        auto file = payload["file"].get<string>();
+        auto has_workspace = payload.contains("path");
+        auto key = has_workspace ? workspace_key(payload) : "";
+        if(has_workspace && !use_compile_commands(payload)){
+            return;
+        }
+        if(has_workspace){
+            resolve_eagerly = payload.value("resolve_eagerly", false);
+        }
+
+        auto start = high_resolution_clock::now();
+        auto result = engine.loadIndex(file, key);
+        auto end = high_resolution_clock::now();
+
+        json res;
+        res["command"] = "load_index";
+        res["status"] = stack_graph::snapshotResultName(result);
+        res["time_ms"] = duration_cast<milliseconds>(end-start).count();
+        res["translation_units"] = engine.translation_units.size();
+        if(result == stack_graph::SNAPSHOT_LOADED && !has_workspace){
+            resolve_all(res, payload.value("threads", 1u));
+        }
+
+        emit(res);
+
+        // With a workspace, a loaded snapshot is brought up to date by an
+        // incremental scan, and one that cannot be used by a full index.
+        if(has_workspace){
+            workspace = key;
+            auto changed = index_directory(payload, res["status"].get<string>().c_str());
+            if(result != stack_graph::SNAPSHOT_LOADED || changed){
+                engine.saveIndex(file, workspace);
+            }
+        }
+    }
+
+    void document_response(const char *command, bool ok, high_resolution_clock::time_point start){
+        auto end = high_resolution_clock::now();
+
+        json res;
+        res["command"] = command;
+        res["status"] = ok ? "ok" : "error";
+        res["time_us"] = duration_cast<microseconds>(end-start).count();
+        emit(res);
+    }
+
+    void did_open(json payload){
+        std::unique_lock<std::shared_mutex> lock(engine_lock);
+
+        auto start = high_resolution_clock::now();
+        auto ok = engine.openDocument(payload["path"].get<string>(), payload["text"].get<string>());
+        document_response("did_open", ok, start);
+    }
+
+    // Either {"path", "edits": [{"range": {"start": {"line", "column"},
+    // "end": {...}}, "text"}]} or {"path", "text"} for the whole document.
+    void did_change(json payload){
+        std::unique_lock<std::shared_mutex> lock(engine_lock);
+
+        auto start = high_resolution_clock::now();
+        auto path = payload["path"].get<string>();
+        bool ok;
+        if(payload.contains("edits")){
+            vector<stack_graph::TextEdit> edits;
+            for(auto &edit : payload["edits"]){
+                auto &range = edit["range"];
+                edits.push_back({
+                    {range["start"]["line"].get<uint32_t>(), range["start"]["column"].get<uint32_t>()},
+                    {range["end"]["line"].get<uint32_t>(), range["end"]["column"].get<uint32_t>()},
+                    edit["text"].get<string>()});
+            }
+            ok = engine.changeDocument(path, edits);
+        }
+        else {
+            ok = engine.documents.count(path) && engine.openDocument(path, payload["text"].get<string>());
+        }
+        document_response("did_change", ok, start);
+    }
+
+    void did_close(json payload){
+        std::unique_lock<std::shared_mutex> lock(engine_lock);
+
+        auto start = high_resolution_clock::now();
+        auto ok = engine.closeDocument(payload["path"].get<string>());
+        document_response("did_close", ok, start);
     }
 
     void resolve(json payload){
+        std::shared_lock<std::shared_mutex> lock(engine_lock);
+
         Coordinate coord(
             payload["path"].get<string>(),
             payload["line"].get<int>(),
             payload["column"].get<int>()
         );
 
+        auto budget = engine.resolve_budget;
+        budget.steps = payload.value("max_steps", budget.steps);
+        budget.time_us = payload.value("max_time_us", budget.time_us);
+
         auto start = high_resolution_clock::now();
-        shared_ptr<Coordinate> result = engine.resolve(coord);
+        stack_graph::ResolveStatus status;
+        shared_ptr<Coordinate> result = engine.resolve(coord, budget, status);
         auto end = high_resolution_clock::now();
 
         auto duration = duration_cast<milliseconds>(end-start);
@@ -120,19 +482,18 @@ struct Reactor
         json res;
         res["command"] = "resolve";
         res["time_ms"] = duration.count();
+        res["status"] = stack_graph::resolveStatusName(status);
 
-        if(result == nullptr){
-            res["status"] = "not_found";
-        }
-        else {
-            res["status"] = "ok";
+        if(result != nullptr){
             res["coordinate"] = {{"path", result->path}, {"line", result->line}, {"column", result->column}};
         }
 
-        std::cout << res.dump() << std::endl;
+        emit(res);
     }
 
     void find_usages(json payload){
+        std::shared_lock<std::shared_mutex> lock(engine_lock);
+
         Coordinate coord(
             payload["path"].get<string>(),
             payload["line"].get<int>(),
@@ -154,22 +515,94 @@ struct Reactor
             res["coordinates"].push_back({{"path", l->path}, {"line", l->line}, {"column", l->column}});
         }
         
-        std::cout << res.dump() << std::endl;
+        emit(res);
+    }
+
+    void include_graph(json payload){
+        std::shared_lock<std::shared_mutex> lock(engine_lock);
+
+        auto start = high_resolution_clock::now();
+        auto relations = engine.includeRelations(payload["path"].get<string>());
+        auto end = high_resolution_clock::now();
+
+        json res;
+        res["command"] = "include_graph";
+        res["time_ms"] = duration_cast<milliseconds>(end-start).count();
+        if(relations == nullptr){
+            res["status"] = "not_found";
+        }
+        else {
+            res["status"] = "ok";
+            res["includes"] = relations->includes;
+            res["transitive_includes"] = relations->transitive_includes;
+            res["includers"] = relations->includers;
+            res["transitive_includers"] = relations->transitive_includers;
+        }
+
+        emit(res);
+    }
+
+    void stats(){
+        std::shared_lock<std::shared_mutex> lock(engine_lock);
+
+        auto s = engine.stats();
+
+        json res;
+        res["command"] = "stats";
+        res["status"] = "ok";
+        res["translation_units"] = s.translation_units;
+        res["nodes"] = s.nodes;
+        res["tree_bytes"] = s.tree_bytes;
+        res["node_table_bytes"] = s.node_table_bytes;
+        res["usage_index_bytes"] = s.usage_index_bytes;
+        res["reference_index_bytes"] = s.reference_index_bytes;
+        res["include_graph_bytes"] = s.include_graph_bytes;
+        res["resolution_table_bytes"] = s.resolution_table_bytes;
+        res["symbols"] = {
+            {"size", s.symbols.size},
+            {"bytes", s.symbols.bytes},
+            {"hit_rate", s.symbols.lookups == 0 ? 0.0 : (double)s.symbols.hits / s.symbols.lookups}};
+        res["parsers_created"] = s.parsers_created;
+        res["bytes_read"] = s.bytes_read;
+        res["bytes_copied"] = s.bytes_copied;
+
+        emit(res);
     }
 
     void debug_print_tree(json payload){
         auto path = payload["path"].get<string>();
 
-        std::cout << engine.translation_units[path]->repr() << std::endl;
+        std::shared_lock<std::shared_mutex> lock(engine_lock);
+        auto found = engine.translation_units.find(path);
+        if(found == engine.translation_units.end()){
+            json res;
+            res["command"] = "debug_print_tree";
+            res["status"] = "not_found";
+            emit(res);
+            return;
+        }
+
+        std::lock_guard<std::mutex> output(output_lock);
+        std::cout << found->second->repr() << std::endl;
     }
 
 
 };
 
-int main()
+int main(int argc, char **argv)
 {
     Reactor r;
 
+    // --index-snapshot <file>: answer the first index command from the
+    // snapshot when it is fresh, and write one after every full index.
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (string(argv[i]) == "--index-snapshot")
+        {
+            r.snapshot = argv[i + 1];
+        }
+    }
+
     r.loop();
 
     return 0;
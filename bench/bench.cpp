@@ -0,0 +1,161 @@
+#include "bench.h"
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <thread>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+
+using namespace std::chrono;
+
+vector<BenchCase> &bench_registry()
+{
+    static vector<BenchCase> registry;
+    return registry;
+}
+
+double bench_time_ms(std::function<void()> fn, int iterations)
+{
+    auto start = high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+    auto end = high_resolution_clock::now();
+
+    return duration_cast<duration<double, std::milli>>(end - start).count() / iterations;
+}
+
+size_t bench_rss_bytes()
+{
+    malloc_trim(0);
+
+    size_t pages = 0, resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void bench_reset_peak_rss()
+{
+    malloc_trim(0);
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+size_t bench_peak_rss_bytes()
+{
+    std::ifstream status("/proc/self/status");
+    string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return std::stoull(line.substr(6)) * 1024;
+        }
+    }
+    return 0;
+}
+
+vector<unsigned int> bench_thread_counts()
+{
+    unsigned int hw = std::max(1u, std::thread::hardware_concurrency());
+    vector<unsigned int> counts;
+    for (unsigned int t = 1; t < hw; t *= 2)
+    {
+        counts.push_back(t);
+    }
+    counts.push_back(hw);
+    return counts;
+}
+
+string bench_synthetic_corpus(const string &name, int modules, int files_per_module)
+{
+    static std::set<string> written;
+    auto root = fs::temp_directory_path() / ("c-language-server-bench-" + name);
+    if (written.count(name) != 0)
+    {
+        return root.string();
+    }
+    written.insert(name);
+
+    fs::remove_all(root);
+    fs::create_directories(root / "include");
+
+    std::ofstream(root / "include" / "common.h") << R"raw(
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+struct device {
+    int id;
+    struct list_head list;
+    void *private_data;
+};
+)raw";
+
+    for (int m = 0; m < modules; m++)
+    {
+        auto mod = "mod" + std::to_string(m);
+        auto dir = root / (m % 4 == 3 ? "drivers" : "kernel") / mod;
+        fs::create_directories(dir);
+
+        std::ofstream header(dir / (mod + ".h"));
+        header << "#include \"common.h\"\n";
+        if (m > 0)
+        {
+            header << "#include \"mod" << m - 1 << ".h\"\n";
+        }
+        header << "\nstruct " << mod << "_state {\n    int flags;\n    struct device dev;\n    struct list_head entries;\n";
+        if (m > 0)
+        {
+            header << "    struct mod" << m - 1 << "_state *parent;\n";
+        }
+        header << "};\n\nint " << mod << "_init(struct " << mod << "_state *state);\n";
+
+        for (int f = 0; f < files_per_module; f++)
+        {
+            std::ofstream source(dir / ("file" + std::to_string(f) + ".c"));
+            source << "#include \"" << mod << ".h\"\n\n";
+            source << "static int helper" << f << "(struct " << mod << "_state *state, int x)\n{\n";
+            source << "    struct list_head *it = state->entries.next;\n";
+            source << "    int total = state->dev.id + x;\n";
+            source << "    while (it != &state->entries) {\n        total += state->flags;\n        it = it->next;\n    }\n";
+            if (m > 0)
+            {
+                source << "    total += state->parent->dev.id + state->parent->flags;\n";
+            }
+            source << "    return total;\n}\n\n";
+            source << "int " << mod << "_entry" << f << "(struct " << mod << "_state *state)\n{\n";
+            source << "    struct device *dev = &state->dev;\n";
+            source << "    for (int i = 0; i < " << f + 1 << "; i++) {\n        dev->id = helper" << f << "(state, i);\n    }\n";
+            source << "    return " << mod << "_init(state) + dev->id;\n}\n";
+        }
+    }
+
+    return root.string();
+}
+
+void bench_report(const string &bench, const string &metric, double value, const string &unit)
+{
+    std::cout << bench << "\t" << metric << "\t" << value << " " << unit << std::endl;
+}
+
+// Usage: bench [name-substring]
+int main(int argc, char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : "";
+
+    for (auto &b : bench_registry())
+    {
+        if (strstr(b.name, filter) != nullptr)
+        {
+            b.run();
+        }
+    }
+
+    return 0;
+}
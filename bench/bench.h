@@ -0,0 +1,48 @@
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+using std::string;
+using std::vector;
+
+#ifndef BENCH_H
+#define BENCH_H
+
+struct BenchCase
+{
+    const char *name;
+    void (*run)();
+};
+
+vector<BenchCase> &bench_registry();
+
+// Milliseconds per iteration of fn, averaged over the given number of runs.
+double bench_time_ms(std::function<void()> fn, int iterations = 1);
+
+// Current resident set size of the process.
+size_t bench_rss_bytes();
+
+// Starts tracking the peak resident set size afresh.
+void bench_reset_peak_rss();
+
+// Peak resident set size since the last reset.
+size_t bench_peak_rss_bytes();
+
+// 1, 2, 4, ... up to and including the hardware thread count.
+vector<unsigned int> bench_thread_counts();
+
+// Writes a kernel-shaped tree of C sources under the system temp directory
+// (once per process) and returns its root. Every module directory holds one
+// header and files_per_module .c files; module k includes module k - 1.
+string bench_synthetic_corpus(const string &name, int modules, int files_per_module);
+
+void bench_report(const string &bench, const string &metric, double value, const string &unit);
+
+#define BENCH(name)                                                                                  \
+    static void bench_##name();                                                                      \
+    static bool bench_##name##_registered = (bench_registry().push_back({#name, bench_##name}), true); \
+    static void bench_##name()
+
+#endif
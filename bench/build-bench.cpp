@@ -0,0 +1,88 @@
+#include "bench.h"
+#include <stack-graph-tree.h>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+extern "C" TSLanguage *tree_sitter_c();
+
+BENCH(Build)
+{
+    auto root = bench_synthetic_corpus("index", 1000, 8);
+
+    vector<string> sources;
+    for (const auto &entry : fs::recursive_directory_iterator(root))
+    {
+        if (entry.is_regular_file())
+        {
+            std::ifstream in(entry.path());
+            std::stringstream ss;
+            ss << in.rdbuf();
+            sources.push_back(ss.str());
+        }
+    }
+
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_c());
+
+    vector<TSTree *> trees;
+    auto parse_ms = bench_time_ms([&]()
+                                  {
+        for (auto &source : sources)
+        {
+            trees.push_back(ts_parser_parse_string(parser, NULL, source.data(), source.size()));
+        } });
+
+    bench_report("Build", "files", sources.size(), "");
+    bench_report("Build", "parse", parse_ms * 1000 / sources.size(), "us/file");
+
+    const std::pair<const char *, stack_graph::StackGraphBuilder> builders[] = {
+        {"recursive build", stack_graph::RECURSIVE_BUILDER},
+        {"cursor build", stack_graph::CURSOR_BUILDER}};
+
+    for (auto &builder : builders)
+    {
+        stack_graph::StringInterner symbols;
+        auto build_ms = bench_time_ms([&]()
+                                      {
+            for (size_t i = 0; i < trees.size(); i++)
+            {
+                stack_graph::build_stack_graph_tree(ts_tree_root_node(trees[i]), sources[i], symbols, builder.second);
+            } }, 5);
+
+        bench_report("Build", builder.first, build_ms * 1000 / sources.size(), "us/file");
+    }
+
+    for (auto tree : trees)
+    {
+        ts_tree_delete(tree);
+    }
+
+    // A struct-heavy header: every field names a struct type declared before
+    // it, so each declaration looks its type up among thousands of scopes.
+    std::stringstream header;
+    const int structs = 3000;
+    for (int i = 0; i < structs; i++)
+    {
+        header << "struct s" << i << " {\n    int id;\n";
+        for (int j = 1; j <= 8 && j <= i; j++)
+        {
+            header << "    struct s" << i - j << " *link" << j << ";\n";
+        }
+        header << "};\n";
+    }
+    auto source = header.str();
+    auto tree = ts_parser_parse_string(parser, NULL, source.data(), source.size());
+    for (auto &builder : builders)
+    {
+        stack_graph::StringInterner symbols;
+        auto build_ms = bench_time_ms([&]()
+                                      { stack_graph::build_stack_graph_tree(ts_tree_root_node(tree), source, symbols, builder.second); }, 5);
+
+        bench_report("Build", string(builder.first) + ", struct-heavy header", build_ms, "ms");
+    }
+    ts_tree_delete(tree);
+    ts_parser_delete(parser);
+}
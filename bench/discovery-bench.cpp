@@ -0,0 +1,47 @@
+#include "bench.h"
+#include <workspace-discovery.h>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+using stack_graph::DiscoveredFile;
+using stack_graph::FileStream;
+using stack_graph::PathFilter;
+
+BENCH(Discovery)
+{
+    auto root = bench_synthetic_corpus("discovery", 2000, 8);
+    vector<string> excludes = {"/drivers/"};
+    PathFilter filter(excludes);
+    size_t found_before = 0, found_after = 0;
+
+    auto before = bench_time_ms([&]()
+                                {
+        found_before = 0;
+        for (const auto &entry : fs::recursive_directory_iterator(root))
+        {
+            if (!entry.is_directory() && !filter.isExcluded(entry.path().string()) &&
+                stack_graph::isSourceFileName(entry.path().filename().string()))
+            {
+                found_before++;
+            }
+        } });
+
+    bench_report("Discovery", "files", found_before, "");
+    bench_report("Discovery", "recursive_directory_iterator", before, "ms");
+
+    for (unsigned int threads : bench_thread_counts())
+    {
+        auto after = bench_time_ms([&]()
+                                   {
+            FileStream stream;
+            stack_graph::discoverSourceFiles(root, filter, threads, false, stream);
+            found_after = stream.queue.size(); });
+
+        if (found_before != found_after)
+        {
+            std::cerr << "Discovery: results differ " << found_before << " vs " << found_after << std::endl;
+        }
+        bench_report("Discovery", "getdents64 crawler, " + std::to_string(threads) + " threads", after, "ms");
+    }
+}
@@ -0,0 +1,44 @@
+#include "bench.h"
+#include <stack-graph-engine.h>
+#include <fstream>
+#include <sstream>
+
+using stack_graph::StackGraphEngine;
+
+BENCH(Edit)
+{
+    auto root = bench_synthetic_corpus("index", 1000, 8);
+
+    StackGraphEngine engine;
+    engine.crossLink(engine.loadDirectoryRecursive(root, {}));
+
+    // A .c file nothing includes, and a header half of the corpus includes.
+    auto source = root + "/kernel/mod500/file3.c";
+    auto header = root + "/kernel/mod500/mod500.h";
+
+    for (auto &path : {source, header})
+    {
+        std::ifstream in(path);
+        std::stringstream text;
+        text << in.rdbuf();
+        engine.openDocument(path, text.str());
+
+        // Types a comment into the first line and deletes it again.
+        int edits = 0;
+        auto ms = bench_time_ms([&]()
+                                {
+            stack_graph::Point at = {0, 0};
+            if (edits++ % 2 == 0)
+            {
+                engine.changeDocument(path, {{at, at, "/* x */"}});
+            }
+            else
+            {
+                engine.changeDocument(path, {{at, {0, 7}, ""}});
+            } },
+                                20);
+
+        engine.closeDocument(path);
+        bench_report("Edit", path == source ? "edit to queryable, .c file" : "edit to queryable, widely included header", ms, "ms");
+    }
+}
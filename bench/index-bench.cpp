@@ -0,0 +1,127 @@
+#include "bench.h"
+#include <stack-graph-engine.h>
+#include <fstream>
+
+using stack_graph::StackGraphEngine;
+
+BENCH(Index)
+{
+    auto root = bench_synthetic_corpus("index", 1000, 8);
+
+    auto rss_before = bench_rss_bytes();
+    {
+        StackGraphEngine engine;
+
+        auto index_ms = bench_time_ms([&]()
+                                      { engine.loadDirectoryRecursive(root, {}); });
+        auto rss_indexed = bench_rss_bytes();
+
+        bench_reset_peak_rss();
+        auto crosslink_ms = bench_time_ms([&]()
+                                          { engine.crossLink(); });
+        auto peak_crosslink = bench_peak_rss_bytes();
+
+        stack_graph::IndexDelta delta;
+        auto reindex_ms = bench_time_ms([&]()
+                                        { delta = engine.loadDirectoryRecursive(root, {}); });
+        auto relink_ms = bench_time_ms([&]()
+                                       { engine.crossLink(delta); });
+
+        bench_report("Index", "translation units", engine.translation_units.size(), "");
+        bench_report("Index", "nodes", engine.stats().nodes, "");
+        bench_report("Index", "tree arenas", engine.stats().tree_bytes / (1024.0 * 1024.0), "MiB");
+        bench_report("Index", "index", index_ms, "ms");
+        bench_report("Index", "crosslink", crosslink_ms, "ms");
+        bench_report("Index", "unchanged re-index", reindex_ms, "ms");
+        bench_report("Index", "unchanged crosslink", relink_ms, "ms");
+        bench_report("Index", "resident after index", (rss_indexed - rss_before) / (1024.0 * 1024.0), "MiB");
+        bench_report("Index", "peak during crosslink", (peak_crosslink - rss_before) / (1024.0 * 1024.0), "MiB");
+        bench_report("Index", "resident after crosslink", (bench_rss_bytes() - rss_before) / (1024.0 * 1024.0), "MiB");
+    }
+    bench_report("Index", "resident after engine destroyed", ((double)bench_rss_bytes() - rss_before) / (1024.0 * 1024.0), "MiB");
+}
+
+BENCH(CrossLinkThreads)
+{
+    auto root = bench_synthetic_corpus("index", 1000, 8);
+
+    StackGraphEngine engine;
+    engine.loadDirectoryRecursive(root, {});
+
+    vector<string> serial;
+    for (unsigned int threads : bench_thread_counts())
+    {
+        auto ms = bench_time_ms([&]()
+                                { engine.crossLink(threads); });
+
+        vector<string> links;
+        for (auto &link : engine.cross_links)
+        {
+            links.push_back(link.repr());
+        }
+        if (threads == 1)
+        {
+            serial = links;
+        }
+        else if (links != serial)
+        {
+            std::cerr << "CrossLinkThreads: links differ with " << threads << " threads" << std::endl;
+        }
+        bench_report("CrossLinkThreads", "crosslink, " + std::to_string(threads) + " threads", ms, "ms");
+    }
+}
+
+// Indexes what a compile_commands.json for the first 100 modules compiles,
+// each command with the same long -I list, against the whole directory.
+BENCH(CompileCommands)
+{
+    auto root = bench_synthetic_corpus("index", 1000, 8);
+    auto database = root + "/compile_commands.json";
+    {
+        auto module_dir = [&](int m)
+        { return root + (m % 4 == 3 ? "/drivers/mod" : "/kernel/mod") + std::to_string(m); };
+
+        string includes = "-I" + root + "/include";
+        for (int m = 0; m < 100; m++)
+        {
+            includes += " -I" + module_dir(m);
+        }
+
+        std::ofstream out(database);
+        out << "[";
+        for (int m = 0; m < 100; m++)
+        {
+            for (int f = 0; f < 8; f++)
+            {
+                out << (m || f ? ",\n" : "\n") << "{\"directory\": \"" << module_dir(m) << "\", \"file\": \"file" << f
+                    << ".c\", \"command\": \"cc " << includes << " -c file" << f << ".c\"}";
+            }
+        }
+        out << "\n]\n";
+    }
+
+    for (bool use_database : {false, true})
+    {
+        string label = use_database ? "compile_commands" : "directory";
+        auto rss_before = bench_rss_bytes();
+        {
+            StackGraphEngine engine;
+            engine.useCompileCommands(use_database ? database : "");
+
+            auto index_ms = bench_time_ms([&]()
+                                          { engine.loadDirectoryRecursive(root, {}); });
+            auto crosslink_ms = bench_time_ms([&]()
+                                              { engine.crossLink(); });
+            stack_graph::IndexDelta delta;
+            auto reindex_ms = bench_time_ms([&]()
+                                            { delta = engine.loadDirectoryRecursive(root, {}); });
+
+            bench_report("CompileCommands", label + ": translation units", engine.translation_units.size(), "");
+            bench_report("CompileCommands", label + ": include edges", engine.includes.edges, "");
+            bench_report("CompileCommands", label + ": index", index_ms, "ms");
+            bench_report("CompileCommands", label + ": crosslink", crosslink_ms, "ms");
+            bench_report("CompileCommands", label + ": unchanged re-index", reindex_ms, "ms");
+            bench_report("CompileCommands", label + ": resident after crosslink", (bench_rss_bytes() - rss_before) / (1024.0 * 1024.0), "MiB");
+        }
+    }
+}
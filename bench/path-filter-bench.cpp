@@ -0,0 +1,112 @@
+#include "bench.h"
+#include <path-filter.h>
+#include <algorithm>
+#include <regex>
+
+using stack_graph::PathFilter;
+
+static vector<string> _kernel_like_paths()
+{
+    vector<string> dirs = {"drivers/net/ethernet", "arch/x86/kernel", "fs/ext4", "net/ipv4", "include/linux",
+                           "kernel/sched", "mm", "sound/core", "Documentation/admin-guide", "tools/perf/util"};
+    vector<string> paths;
+    for (auto &dir : dirs)
+    {
+        for (int i = 0; i < 3000; i++)
+        {
+            auto ext = i % 5 == 0 ? ".txt" : (i % 2 == 0 ? ".h" : ".c");
+            paths.push_back("/home/user/linux/" + dir + "/file_" + std::to_string(i) + ext);
+        }
+    }
+    return paths;
+}
+
+static string _filename(const string &path)
+{
+    return path.substr(path.rfind('/') + 1);
+}
+
+BENCH(PathFilter)
+{
+    auto paths = _kernel_like_paths();
+    vector<string> excludes = {"/drivers/", "/Documentation/", "/tools/", "/arch/", "/sound/"};
+    size_t kept_before = 0, kept_after = 0;
+
+    auto before = bench_time_ms([&]()
+                                {
+        std::regex regex("[a-z0-9\\-_]*\\.(c|h)");
+        kept_before = 0;
+        for (auto &path : paths)
+        {
+            if (std::any_of(excludes.begin(), excludes.end(), [&](string r)
+                            { return RE2::PartialMatch(path, r); }))
+            {
+                continue;
+            }
+            if (std::regex_match(_filename(path), regex))
+            {
+                kept_before++;
+            }
+        } });
+
+    auto after = bench_time_ms([&]()
+                               {
+        PathFilter filter(excludes);
+        kept_after = 0;
+        for (auto &path : paths)
+        {
+            if (filter.isExcluded(path))
+            {
+                continue;
+            }
+            if (stack_graph::isSourceFileName(_filename(path)))
+            {
+                kept_after++;
+            }
+        } });
+
+    if (kept_before != kept_after)
+    {
+        std::cerr << "PathFilter: results differ " << kept_before << " vs " << kept_after << std::endl;
+    }
+
+    bench_report("PathFilter", "paths", paths.size(), "");
+    bench_report("PathFilter", "per-pattern PartialMatch + std::regex", before, "ms");
+    bench_report("PathFilter", "RE2::Set + precompiled RE2", after, "ms");
+}
+
+BENCH(CrossLinkClassifier)
+{
+    auto paths = _kernel_like_paths();
+    vector<string> names;
+    for (auto &path : paths)
+    {
+        names.push_back(_filename(path));
+    }
+    size_t matched_before = 0, matched_after = 0;
+
+    auto before = bench_time_ms([&]()
+                                {
+        matched_before = 0;
+        for (auto &name : names)
+        {
+            matched_before += RE2::FullMatch(name, "[a-z0-9\\-_]*\\.c") + RE2::FullMatch(name, "[a-z0-9\\-_]*\\.h");
+        } });
+
+    auto after = bench_time_ms([&]()
+                               {
+        matched_after = 0;
+        for (auto &name : names)
+        {
+            matched_after += stack_graph::isCFileName(name) + stack_graph::isHeaderFileName(name);
+        } });
+
+    if (matched_before != matched_after)
+    {
+        std::cerr << "CrossLinkClassifier: results differ" << std::endl;
+    }
+
+    bench_report("CrossLinkClassifier", "names", names.size(), "");
+    bench_report("CrossLinkClassifier", "RE2::FullMatch with pattern string", before, "ms");
+    bench_report("CrossLinkClassifier", "precompiled RE2", after, "ms");
+}
@@ -0,0 +1,155 @@
+#include "bench.h"
+#include <stack-graph-engine.h>
+#include <fstream>
+#include <filesystem>
+
+using stack_graph::Coordinate;
+using stack_graph::StackGraphEngine;
+
+BENCH(Usages)
+{
+    for (int modules : {100, 300, 1000})
+    {
+        auto root = bench_synthetic_corpus("usages-" + std::to_string(modules), modules, 8);
+
+        StackGraphEngine engine;
+        engine.crossLink(engine.loadDirectoryRecursive(root, {}));
+
+        // struct device in common.h, which every module embeds, the state
+        // struct of one module, used by that module and the next, the id
+        // field of struct device, named in references everywhere, and its
+        // private_data field, named nowhere.
+        auto mod = "mod" + std::to_string(modules / 2);
+        Coordinate device(root + "/include/common.h", 5, 7);
+        Coordinate state(root + "/kernel/" + mod + "/" + mod + ".h", 3, 7);
+        Coordinate id(root + "/include/common.h", 6, 8);
+        Coordinate unused(root + "/include/common.h", 8, 10);
+
+        auto label = std::to_string(modules) + " modules";
+        for (auto &coord : {device, state, id, unused})
+        {
+            size_t results = 0;
+            auto ms = bench_time_ms([&]()
+                                    { results = engine.findUsages(coord).size(); },
+                                    100);
+            auto what = coord == device ? "shared struct, " : coord == state ? "module struct, " : coord == id ? "shared field, " : "unused field, ";
+            bench_report("Usages", string("find usages of a ") + what + label, ms, "ms");
+            bench_report("Usages", string("results for a ") + what + label, results, "");
+            if (results > 0)
+            {
+                bench_report("Usages", string("per result, ") + what + label, ms * 1000 / results, "us");
+            }
+        }
+    }
+}
+
+BENCH(Resolve)
+{
+    auto root = bench_synthetic_corpus("usages-1000", 1000, 8);
+
+    StackGraphEngine engine;
+    engine.crossLink(engine.loadDirectoryRecursive(root, {}));
+
+    vector<Coordinate> references;
+    for (auto &file : engine.node_table.files)
+    {
+        for (auto &entry : file.entries)
+        {
+            if (stack_graph::NodeRef(file.tree, entry.id)->kind == stack_graph::StackGraphNodeKind::REFERENCE)
+            {
+                references.push_back(Coordinate(file.path, entry.line, entry.column));
+            }
+        }
+    }
+
+    size_t resolved = 0;
+    auto ms = bench_time_ms([&]()
+                            {
+        for (auto &coord : references)
+        {
+            resolved += engine.resolve(coord) != nullptr;
+        } });
+
+    bench_report("Resolve", "references", references.size(), "");
+    bench_report("Resolve", "resolved", resolved, "");
+    bench_report("Resolve", "per reference", ms * 1000 / references.size(), "us");
+
+    for (unsigned int threads : bench_thread_counts())
+    {
+        auto pass_ms = bench_time_ms([&]()
+                                     { engine.resolveAll(threads); });
+        bench_report("Resolve", "resolve all, " + std::to_string(threads) + " threads", pass_ms, "ms");
+    }
+    auto &table = engine.resolutions;
+    bench_report("Resolve", "resolved by the pass", (double)table.resolved / table.references, "");
+    bench_report("Resolve", "resolution table", table.memoryUsage() / (1024.0 * 1024.0), "MiB");
+
+    size_t looked_up = 0;
+    ms = bench_time_ms([&]()
+                       {
+        for (auto &coord : references)
+        {
+            looked_up += engine.resolve(coord) != nullptr;
+        } });
+    if (looked_up != resolved)
+    {
+        std::cerr << "Resolve: the table resolved " << looked_up << " references, the walk " << resolved << std::endl;
+    }
+    bench_report("Resolve", "per reference, from the table", ms * 1000 / references.size(), "us");
+}
+
+BENCH(ResolveWide)
+{
+    // A header in the shape of include/linux/fs.h: thousands of globals, a
+    // struct with thousands of fields, and an inline function using both.
+    const int globals = 5000, fields = 2000;
+    auto root = std::filesystem::temp_directory_path() / "c-language-server-bench-wide";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    {
+        std::ofstream header(root / "wide.h");
+        for (int i = 0; i < globals; i++)
+        {
+            header << "int g" << i << ";\n";
+        }
+        header << "struct big {\n";
+        for (int i = 0; i < fields; i++)
+        {
+            header << "    int f" << i << ";\n";
+        }
+        header << "};\n\nstatic inline void touch(struct big *b)\n{\n";
+        for (int i = 0; i < fields; i++)
+        {
+            header << "    g" << (globals - 1 - i) << " = b->f" << i << ";\n";
+        }
+        header << "}\n";
+    }
+
+    StackGraphEngine engine;
+    engine.crossLink(engine.loadDirectoryRecursive(root.string(), {}));
+
+    vector<Coordinate> references;
+    for (auto &file : engine.node_table.files)
+    {
+        for (auto &entry : file.entries)
+        {
+            if (stack_graph::NodeRef(file.tree, entry.id)->kind == stack_graph::StackGraphNodeKind::REFERENCE)
+            {
+                references.push_back(Coordinate(file.path, entry.line, entry.column));
+            }
+        }
+    }
+
+    size_t resolved = 0;
+    auto ms = bench_time_ms([&]()
+                            {
+        for (auto &coord : references)
+        {
+            resolved += engine.resolve(coord) != nullptr;
+        } },
+                            5);
+
+    bench_report("ResolveWide", "references", references.size(), "");
+    bench_report("ResolveWide", "resolved", resolved / 5, "");
+    bench_report("ResolveWide", "per reference", ms * 1000 / references.size(), "us");
+}
@@ -0,0 +1,64 @@
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+#ifndef COMPILE_DATABASE_H
+#define COMPILE_DATABASE_H
+
+namespace stack_graph
+{
+    // Includes of files in this context are matched by file name, as when
+    // no compilation database is used.
+    const uint32_t NAME_CONTEXT = 0;
+
+    // The translation units of a compile_commands.json and where their
+    // includes are searched. A context is a directory searched first plus
+    // a search path: a source file gets its own directory and the search
+    // path of its command, a header the directory it lives in and the
+    // search path of the first file including it.
+    struct CompileDatabase
+    {
+        struct Context
+        {
+            string directory;
+            uint32_t search;
+        };
+
+        // -iquote, -I, -isystem and -idirafter directories in search order.
+        vector<vector<string>> searches;
+        vector<Context> contexts = {{"", 0}};
+        unordered_map<string, uint32_t> search_ids;
+        unordered_map<string, uint32_t> context_ids;
+        // Source files in database order, and their contexts.
+        vector<string> sources;
+        unordered_map<string, uint32_t> units;
+
+        // Reads `file`; fails and stays empty when it cannot be read or is
+        // not a list of commands.
+        bool load(const string &file);
+
+        bool empty() const
+        {
+            return sources.empty();
+        }
+
+        uint32_t contextOf(const string &path) const;
+
+        // The context of `header` when a file in `context` includes it.
+        uint32_t derive(uint32_t context, const string &header);
+
+        // The first candidate for `spelling` that `exists` accepts, or "".
+        string resolve(uint32_t context, const string &spelling, std::function<bool(const string &)> exists) const;
+
+        void clear();
+
+        uint32_t _context(const string &directory, uint32_t search);
+    };
+}
+
+#endif
@@ -0,0 +1,48 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <path-filter.h>
+
+using std::string;
+using std::vector;
+
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+namespace stack_graph
+{
+    // Watches every directory below `root` that is not excluded with inotify
+    // and reports which source files and directories changed.
+    struct FileWatcher
+    {
+        string root;
+        PathFilter filter;
+        bool follow_symlinks;
+        int fd = -1;
+        int wake[2] = {-1, -1};
+        std::unordered_map<int, string> directories;
+        bool out_of_watches = false;
+
+        FileWatcher(const string &root, const vector<string> &excludes, bool follow_symlinks = false);
+
+        ~FileWatcher();
+
+        // Fails when inotify is unavailable or the watch limit is reached.
+        bool start();
+
+        // Blocks until something changes, then keeps collecting events until
+        // none arrived for `debounce_ms`, or for at most ten times that, so a
+        // burst such as a checkout becomes one batch. Paths below a changed
+        // directory are folded into it. Returns false once stopped.
+        bool nextBatch(vector<string> &paths, unsigned int debounce_ms);
+
+        // Wakes nextBatch from another thread.
+        void stop();
+
+        void _watchTree(const string &dir);
+
+        void _unwatchTree(const string &dir);
+    };
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <node-table.h>
+
+using std::unordered_map;
+using std::vector;
+
+#ifndef INCLUDE_GRAPH_H
+#define INCLUDE_GRAPH_H
+
+namespace stack_graph
+{
+    // The includes between indexed files, by NodeTable file id. A file's
+    // include spellings are recorded when its tree is added, each distinct
+    // spelling is resolved to a file once, and the resolved edges are kept
+    // as adjacency lists both ways. Resolutions are dropped when a file
+    // comes or goes, as any spelling may then resolve differently.
+    //
+    // A spelling is resolved in the context of the including file, so the
+    // same spelling may name different files in different places. Contexts
+    // are opaque here: seeded files bring theirs, files they reach take one
+    // derived from their includer's, and files nothing reaches get 0.
+    struct IncludeGraph
+    {
+        struct File
+        {
+            bool present = false;
+            vector<SymbolId> spellings;
+            // What each spelling resolved to, NO_FILE included.
+            vector<uint32_t> targets;
+            uint32_t context = 0;
+            // In include order, each file once; unresolved includes and the
+            // file itself are left out.
+            vector<uint32_t> includes;
+            vector<uint32_t> includers;
+        };
+
+        vector<File> files;
+        // By context in the high and spelling in the low half.
+        unordered_map<uint64_t, uint32_t> resolved;
+        bool stale = false;
+        size_t edges = 0;
+
+        // Records the IMPORT nodes of `tree` as the includes of `file`.
+        void insert(uint32_t file, StackGraphTree &tree);
+
+        void erase(uint32_t file);
+
+        // Resolves the spellings not resolved yet and rebuilds the edges if
+        // anything changed since the last update. Files are visited breadth
+        // first from the `seeds`, pairs of file and context, and then in id
+        // order. `resolve` returns NO_FILE for spellings that match no file;
+        // `derive` gives the context of a file first reached from a file in
+        // the given context.
+        void update(const vector<std::pair<uint32_t, uint32_t>> &seeds,
+                    std::function<uint32_t(uint32_t, SymbolId)> resolve,
+                    std::function<uint32_t(uint32_t, uint32_t)> derive);
+
+        // Files reachable over includes, or over includers, in breadth-first
+        // order, without `file` itself.
+        vector<uint32_t> reachable(uint32_t file, bool includers) const;
+
+        // The spellings of `file`, or none.
+        const vector<SymbolId> &spellingsOf(uint32_t file) const;
+
+        const vector<uint32_t> &includesOf(uint32_t file) const;
+
+        void clear();
+
+        size_t memoryUsage() const;
+    };
+}
+
+#endif
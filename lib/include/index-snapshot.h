@@ -0,0 +1,23 @@
+#include <stdint.h>
+
+#ifndef INDEX_SNAPSHOT_H
+#define INDEX_SNAPSHOT_H
+
+namespace stack_graph
+{
+    // Bumped whenever the on-disk layout or the meaning of a field changes.
+    const uint32_t SNAPSHOT_VERSION = 2;
+
+    enum SnapshotResult
+    {
+        SNAPSHOT_LOADED,
+        SNAPSHOT_MISSING,
+        SNAPSHOT_VERSION_MISMATCH,
+        SNAPSHOT_CORRUPT,
+        SNAPSHOT_STALE
+    };
+
+    const char *snapshotResultName(SnapshotResult result);
+}
+
+#endif
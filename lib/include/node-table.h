@@ -0,0 +1,72 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stack-graph-tree.h>
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+#ifndef NODE_TABLE_H
+#define NODE_TABLE_H
+
+namespace stack_graph
+{
+    const uint32_t NO_FILE = UINT32_MAX;
+
+    // Maps source positions to stack graph nodes. Every path is stored once,
+    // in the file table, and each file keeps its node positions sorted by
+    // (line, column), so a lookup is a hash of the path plus a binary search
+    // and replacing a file costs O(file).
+    struct NodeTable
+    {
+        struct Entry
+        {
+            uint32_t line;
+            uint32_t column;
+            NodeId id;
+        };
+
+        struct File
+        {
+            string path;
+            StackGraphTree *tree = nullptr;
+            vector<Entry> entries;
+            // Nodes hidden by a later node at the same position, sorted.
+            vector<NodeId> shadowed;
+        };
+
+        unordered_map<string, uint32_t> file_ids;
+        unordered_map<const StackGraphTree *, uint32_t> tree_ids;
+        vector<File> files;
+        size_t count = 0;
+
+        // Indexes every node of `tree` under `path`, replacing what was there.
+        // Where several nodes share a position the last one wins. Returns
+        // the file id, which stays with the path for good.
+        uint32_t insert(const string &path, StackGraphTree &tree);
+
+        void erase(const string &path);
+
+        NodeRef find(const string &path, uint32_t line, uint32_t column) const;
+
+        NodeRef find(uint32_t file, uint32_t line, uint32_t column) const;
+
+        // Whether find returns `id` for its own position in `file`.
+        bool visible(uint32_t file, NodeId id) const;
+
+        // The id of the file `tree` is indexed under, or NO_FILE.
+        uint32_t fileOf(const StackGraphTree *tree) const;
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        void clear();
+
+        size_t memoryUsage() const;
+    };
+}
+
+#endif
@@ -0,0 +1,31 @@
+#include <string>
+#include <vector>
+#include <re2/re2.h>
+#include <re2/set.h>
+
+using std::string;
+using std::vector;
+
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+namespace stack_graph
+{
+    bool isSourceFileName(const string &file);
+
+    bool isCFileName(const string &file);
+
+    bool isHeaderFileName(const string &file);
+
+    struct PathFilter
+    {
+        RE2::Set excludes;
+        bool has_excludes;
+
+        PathFilter(const vector<string> &excludes);
+
+        bool isExcluded(const string &path) const;
+    };
+}
+
+#endif
@@ -0,0 +1,68 @@
+#include <vector>
+#include <unordered_map>
+#include <stack-graph-tree.h>
+
+using std::unordered_map;
+using std::vector;
+
+#ifndef REFERENCE_INDEX_H
+#define REFERENCE_INDEX_H
+
+namespace stack_graph
+{
+    // Maps each segment name of a dotted reference such as `a.b.c` to the
+    // reference nodes containing it. Files are numbered as in the node
+    // table. Each file keeps its entries sorted by segment, and every
+    // segment lists the files that held it at some point, so replacing a
+    // file touches only that file's entries.
+    struct ReferenceIndex
+    {
+        struct Entry
+        {
+            SymbolId segment;
+            NodeId node;
+            // Index of the segment within the reference, from the left.
+            uint32_t position;
+        };
+
+        struct Hit
+        {
+            uint32_t file;
+            NodeRef node;
+            uint32_t position;
+        };
+
+        struct File
+        {
+            StackGraphTree *tree = nullptr;
+            vector<Entry> entries;
+            // Segments whose posting list holds this file; kept on erase.
+            vector<SymbolId> posted;
+        };
+
+        vector<File> files;
+        unordered_map<SymbolId, vector<uint32_t>> postings;
+        size_t count = 0;
+
+        // Indexes the REFERENCE nodes of `tree` as `file`, replacing what
+        // was there. Segments are interned in the tree's interner. A node
+        // naming a segment twice is listed once, at its first position.
+        void insert(uint32_t file, StackGraphTree &tree);
+
+        void erase(uint32_t file);
+
+        // Every reference containing `segment`, grouped by file.
+        vector<Hit> find(SymbolId segment) const;
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        void clear();
+
+        size_t memoryUsage() const;
+    };
+}
+
+#endif
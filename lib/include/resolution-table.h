@@ -0,0 +1,71 @@
+#include <vector>
+#include <stack-graph-tree.h>
+#include <node-table.h>
+
+using std::vector;
+
+#ifndef RESOLUTION_TABLE_H
+#define RESOLUTION_TABLE_H
+
+namespace stack_graph
+{
+    enum ResolveStatus
+    {
+        RESOLVE_OK,
+        RESOLVE_NOT_FOUND,
+        // The walk ran out of steps or time.
+        RESOLVE_BUDGET_EXCEEDED,
+        // The walk came back to a link it had followed for the same segment.
+        RESOLVE_CYCLE
+    };
+
+    const char *resolveStatusName(ResolveStatus status);
+
+    // What one resolution may spend. Time is checked every few dozen steps,
+    // so a walk shorter than that always finishes.
+    struct ResolveBudget
+    {
+        size_t steps = 1 << 16;
+        uint32_t time_us = 50000;
+    };
+
+    // The definition each REFERENCE and SYMBOL node resolves to, computed in
+    // one pass after crosslinking. Files are numbered as in the node table,
+    // and each keeps the nodes that resolved or gave up, sorted by node id.
+    // Nodes that gave up hold NO_FILE and their status instead of a
+    // definition. The table
+    // holds for the links it was computed from only, which `generation` and
+    // `jumps` record.
+    struct ResolutionTable
+    {
+        struct Entry
+        {
+            NodeId node;
+            uint32_t file;
+            NodeId definition;
+        };
+
+        struct File
+        {
+            StackGraphTree *tree = nullptr;
+            vector<Entry> entries;
+        };
+
+        vector<File> files;
+        bool built = false;
+        size_t generation = 0;
+        size_t jumps = 0;
+        // Nodes the pass tried, and those that resolved.
+        size_t references = 0;
+        size_t resolved = 0;
+
+        // The definition `node` of `file` resolves to, or null and why not.
+        NodeRef find(uint32_t file, NodeId node, ResolveStatus &status) const;
+
+        void clear();
+
+        size_t memoryUsage() const;
+    };
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include <string>
+#include <string_view>
+
+using std::string;
+
+#ifndef SOURCE_BUFFER_H
+#define SOURCE_BUFFER_H
+
+namespace stack_graph
+{
+    // Size, modification time and content hash of a source file, used to
+    // tell whether a file changed since it was indexed. statSource leaves the
+    // hash at 0; it is only known once the file has been read.
+    struct SourceStamp
+    {
+        uint64_t size;
+        int64_t mtime_ns;
+        uint64_t hash;
+
+        bool sameMetadata(const SourceStamp &other) const
+        {
+            return size == other.size && mtime_ns == other.mtime_ns;
+        }
+
+        bool sameContent(const SourceStamp &other) const
+        {
+            return size == other.size && hash == other.hash;
+        }
+    };
+
+    bool statSource(const string &path, SourceStamp &stamp);
+
+    // Fast non-cryptographic 64-bit hash, for change detection and checksums.
+    uint64_t hashBytes(const char *data, size_t size);
+
+    // Files smaller than this are read into `fallback` rather than mapped. A
+    // mapped file truncated while it is parsed faults with SIGBUS; reading
+    // rules that out for the files a workspace is made of, and the copy costs
+    // little at this size. Only larger files, where skipping the copy pays,
+    // keep that risk.
+    const size_t SOURCE_MAP_THRESHOLD = 1 << 20;
+
+    struct SourceBuffer
+    {
+        const char *data;
+        size_t size;
+        bool mapped;
+        string fallback;
+        SourceStamp stamp;
+
+        SourceBuffer(const string &path);
+
+        SourceBuffer(const SourceBuffer &) = delete;
+
+        SourceBuffer &operator=(const SourceBuffer &) = delete;
+
+        ~SourceBuffer();
+
+        std::string_view view()
+        {
+            return std::string_view(data, size);
+        }
+
+        size_t bytesCopied()
+        {
+            return mapped ? 0 : size;
+        }
+    };
+}
+
+#endif
@@ -1,11 +1,26 @@
 #include <utility>
 #include <string>
 #include <stack-graph-tree.h>
+#include <source-buffer.h>
+#include <path-filter.h>
+#include <workspace-discovery.h>
+#include <index-snapshot.h>
+#include <node-table.h>
+#include <usage-index.h>
+#include <reference-index.h>
+#include <symbol-map.h>
+#include <include-graph.h>
+#include <compile-database.h>
+#include <resolution-table.h>
 #include <unordered_map>
 #include <unordered_set>
 #include <tuple>
 #include <sstream>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <filesystem>
 
 using std::string;
 using std::stringstream;
@@ -13,6 +28,8 @@ using std::tuple;
 using std::unordered_map;
 using std::unordered_set;
 
+namespace fs = std::filesystem;
+
 #ifndef STACK_GRAPH_ENGINE_H
 #define STACK_GRAPH_ENGINE_H
 
@@ -26,7 +43,7 @@ namespace stack_graph
 
         Coordinate(string path, uint32_t line, uint32_t column)
         {
-            this->path = path;
+            this->path = std::move(path);
             this->line = line;
             this->column = column;
         }
@@ -36,93 +53,305 @@ namespace stack_graph
             return (path == other.path && line == other.line && column == other.column);
         }
     };
-}
-
-template <>
-struct std::hash<stack_graph::Coordinate>
-{
-    std::size_t operator()(const stack_graph::Coordinate &k) const
-    {
-        using std::hash;
-        using std::size_t;
-        using std::string;
-
-        std::size_t h1 = std::hash<string>{}(k.path);
-        std::size_t h2 = std::hash<uint32_t>{}(k.line);
-        std::size_t h3 = std::hash<uint32_t>{}(k.column);
-        return 31 * 31 * h3 + 31 * h2 + h1;
-    }
-};
-
-namespace stack_graph
-{
 
     struct CrossLink
     {
-        shared_ptr<StackGraphNode> symbol;
-        shared_ptr<StackGraphNode> definition;
+        NodeRef symbol;
+        NodeRef definition;
+        // The symbol's jump_to before it was linked, restored on unlinking.
+        NodeRef previous;
 
-        CrossLink(shared_ptr<StackGraphNode> symbol, shared_ptr<StackGraphNode> definition)
+        CrossLink(NodeRef symbol, NodeRef definition, NodeRef previous = NodeRef())
         {
             this->symbol = symbol;
             this->definition = definition;
+            this->previous = previous;
         }
 
         string repr()
         {
             stringstream ss;
 
-            shared_ptr<StackGraphNode> it = symbol;
-            while (it->parent != nullptr)
-            {
-                it = it->parent;
-            }
+            auto sym_file = symbol.root().symbolText();
+            auto def_file = definition.root().symbolText();
 
-            auto sym_file = it->symbol;
+            ss << "Cross Link {" << sym_file << "#" << symbol.symbolText() << " ~~> " << def_file << "#" << definition.symbolText() << "}";
+            return ss.str();
+        }
+    };
 
-            it = definition;
-            while (it->parent != nullptr)
-            {
-                it = it->parent;
-            }
+    struct ParserPool
+    {
+        std::mutex mutex;
+        vector<TSParser *> idle;
+        std::atomic<size_t> created{0};
 
-            auto def_file = it->symbol;
+        TSParser *acquire();
 
-            ss << "Cross Link {" << sym_file << "#" << symbol->symbol << " ~~> " << def_file << "#" << definition->symbol << "}";
-            return ss.str();
+        void release(TSParser *parser);
+
+        ~ParserPool();
+    };
+
+    struct EngineStats
+    {
+        size_t translation_units;
+        size_t nodes;
+        size_t tree_bytes;
+        size_t node_table_bytes;
+        size_t usage_index_bytes;
+        size_t reference_index_bytes;
+        size_t include_graph_bytes;
+        size_t resolution_table_bytes;
+        InternerStats symbols;
+        size_t parsers_created;
+        size_t bytes_read;
+        size_t bytes_copied;
+    };
+
+    // What a directory scan changed. Units whose stamp or content hash did
+    // not change are skipped and keep their trees and links.
+    struct IndexDelta
+    {
+        size_t skipped = 0;
+        size_t reparsed = 0;
+        size_t added = 0;
+        size_t removed = 0;
+        // Reparsed and added units.
+        vector<string> changed;
+        vector<string> removed_paths;
+        // Units that lost cross links into a replaced or removed unit.
+        vector<string> unlinked;
+
+        bool empty() const
+        {
+            return changed.empty() && removed_paths.empty() && unlinked.empty();
         }
     };
 
+    // The depth-first visit crossLink makes over the imports, recorded:
+    // units in the order the visit finishes them, and for each the finished
+    // units whose definitions it takes, in import order. An import still on
+    // the visit stack is skipped, which breaks include cycles the same way
+    // every time, so the dependencies form a DAG.
+    struct LinkPlan
+    {
+        // File ids in finishing order, and each file's place in it.
+        vector<uint32_t> units;
+        unordered_map<uint32_t, uint32_t> index;
+        vector<vector<uint32_t>> imports;
+        unordered_set<uint32_t> visited;
+    };
+
+    // What include_graph reports for a file.
+    struct IncludeRelations
+    {
+        vector<string> includes;
+        vector<string> transitive_includes;
+        vector<string> includers;
+        vector<string> transitive_includers;
+    };
+
+    // A scanned file. A null tree means the file did not change and `stamp`
+    // only refreshes the indexed one.
+    struct ScannedFile
+    {
+        DiscoveredFile file;
+        shared_ptr<StackGraphTree> sg_tree;
+        SourceStamp stamp;
+    };
+
+    // Files read and parsed by scanPaths, not yet part of the index. Units
+    // below a root that were not scanned again are removed when applied.
+    struct IndexScan
+    {
+        vector<ScannedFile> files;
+        vector<string> roots;
+        vector<string> removed;
+    };
+
+    // Replaces the text between two positions of a document. Columns are
+    // byte offsets, as everywhere else.
+    struct TextEdit
+    {
+        Point start;
+        Point end;
+        string text;
+    };
+
+    // An editor buffer that stands in for the file on disk while it is open.
+    // The syntax tree is kept so edits can be reparsed incrementally.
+    struct OpenDocument
+    {
+        string text;
+        shared_ptr<TSTree> tree;
+        // Whether the file was indexed from disk before it was opened.
+        bool indexed;
+        // Definitions reachable through the document's imports, kept while
+        // the engine generation does not change so edits need not recompute
+        // them.
+        SymbolMap imported;
+        size_t generation = 0;
+    };
+
     struct StackGraphEngine
     {
-        unordered_map<Coordinate, shared_ptr<StackGraphNode>> node_table;
-        unordered_map<string, shared_ptr<StackGraphNode>> translation_units;
+        StringInterner symbols;
+        NodeTable node_table;
+        UsageIndex usages;
+        ReferenceIndex references;
+        IncludeGraph includes;
+        CompileDatabase compile_db;
+        ResolutionTable resolutions;
+        // Spent by resolve and resolveAll on each reference.
+        ResolveBudget resolve_budget;
+        unordered_map<string, shared_ptr<StackGraphTree>> translation_units;
         std::multimap<string, string> name_to_path;
         vector<CrossLink> cross_links;
         unordered_map<string, string> h_to_c;
+        ParserPool parsers;
+        std::atomic<size_t> bytes_read{0};
+        std::atomic<size_t> bytes_copied{0};
+        StackGraphBuilder builder = stack_graph::CURSOR_BUILDER;
+        unordered_map<string, OpenDocument> documents;
+        // Bumped whenever a unit is added, replaced or removed.
+        size_t generation = 0;
 
         bool loadFile(string path);
 
-        void loadDirectoryRecursive(string path, std::vector<string> excludes);
+        shared_ptr<StackGraphTree> parseFile(string path);
+
+        shared_ptr<StackGraphTree> _parseSource(const string &path, SourceBuffer &source);
+
+        // Adds or replaces a unit. A replaced unit is unlinked first.
+        void addTranslationUnit(string path, shared_ptr<StackGraphTree> sg_tree);
+
+        // Drops the units, their node table entries and every cross link into
+        // or out of them. Returns the other units that lost links.
+        unordered_set<string> _retireUnits(const vector<string> &paths);
+
+        void _scanFile(DiscoveredFile file, vector<ScannedFile> &out);
+
+        void _scanFiles(FileStream &stream, unsigned int threads, vector<ScannedFile> &out);
+
+        void _scanDirectory(const string &path, const PathFilter &filter, unsigned int threads, bool follow_symlinks, vector<ScannedFile> &out);
+
+        // Reads and parses the files and directories in `paths` that are new
+        // or whose size, mtime and content hash changed. Only reads the index,
+        // so it may run alongside queries; applyScan then merges the result.
+        IndexScan scanPaths(const vector<string> &paths, const PathFilter &filter, unsigned int threads = 1, bool follow_symlinks = false);
+
+        // Scans the sources of the compilation database under `root` and the
+        // headers their includes resolve to there, following the includes
+        // of each file with its own search path.
+        IndexScan scanCompileCommands(const string &root, const PathFilter &filter, unsigned int threads = 1);
+
+        IndexDelta applyScan(IndexScan &scan);
+
+        // Scans the directory, or only what the compilation database compiles
+        // when one is in use, and reparses only new files and files whose
+        // size, mtime and content hash changed; vanished files are removed.
+        IndexDelta loadDirectoryRecursive(string path, std::vector<string> excludes, unsigned int threads = 1, bool follow_symlinks = false);
+
+        // Opens, or replaces, the overlay for `path`. Scans leave open
+        // documents alone until they are closed.
+        bool openDocument(const string &path, string text);
+
+        // Applies the edits in order and reparses incrementally. Only this
+        // unit's stack graph is rebuilt, and only units it can affect are
+        // linked again.
+        bool changeDocument(const string &path, const vector<TextEdit> &edits);
+
+        // Drops the overlay. The unit is read from disk again if it was
+        // indexed before it was opened, and removed otherwise.
+        bool closeDocument(const string &path);
+
+        bool _updateDocument(const string &path, OpenDocument &document);
 
         string resolveImport(string import);
 
+        // Brings the include graph up to date with the indexed units.
+        void _updateIncludeGraph();
+
+        // Indexes and resolves includes by the compile_commands.json `file`
+        // from now on, or by file name again when `file` is empty. Fails and
+        // falls back to file names when the file cannot be read.
+        bool useCompileCommands(const string &file);
+
+        // Direct includes in include order and transitive ones breadth
+        // first, both ways; null when `path` is not indexed.
+        shared_ptr<IncludeRelations> includeRelations(const string &path);
+
         shared_ptr<Coordinate> resolve(Coordinate c);
 
+        // Resolves within `budget` and says how the walk ended; null unless
+        // `status` is RESOLVE_OK. `steps`, when given, gets the steps the walk
+        // took, 0 when the resolution table answered.
+        shared_ptr<Coordinate> resolve(Coordinate c, const ResolveBudget &budget, ResolveStatus &status, size_t *steps = nullptr);
+
+        // Resolves every REFERENCE and SYMBOL node once, files spread over
+        // `threads` threads, so resolve becomes a table lookup until the
+        // next change to the units or their links. Run after crossLink.
+        void resolveAll(unsigned int threads = 1);
+
+        bool _resolutionsValid() const;
+
         vector<string> importsForTranslationUnit(string path);
 
-        vector<shared_ptr<StackGraphNode>> exportedDefinitionsForTranslationUnit(string path);
+        vector<NodeRef> exportedDefinitionsForTranslationUnit(string path);
 
-        vector<shared_ptr<StackGraphNode>> symbolsForTranslationUnit(string path);
+        vector<NodeRef> symbolsForTranslationUnit(string path);
 
-        void _visitUnitsInTopologicalOrder(unordered_map<string, unordered_map<string, shared_ptr<StackGraphNode>>> &cache,
+        void _visitUnitsInTopologicalOrder(unordered_map<string, SymbolMap> &cache,
                                            unordered_set<string> &visited,
                                            unordered_map<string, string> &h_to_c,
-                                           string unit);
+                                           string unit,
+                                           const unordered_set<string> &relink);
+
+        void _planLinks(LinkPlan &plan, uint32_t file);
+
+        // Gathers the definitions of every planned unit and links the symbols
+        // of those in `relink`. Units are handed to the threads as soon as
+        // their imports are done; links are applied in plan order afterwards,
+        // so the result does not depend on the thread count.
+        void _linkUnits(const LinkPlan &plan, const unordered_set<string> &relink, unsigned int threads);
 
-        void crossLink();
+        SymbolMap _importedDefinitions(unordered_map<string, SymbolMap> &cache,
+                                       unordered_set<string> &visited,
+                                       unordered_map<string, string> &h_to_c,
+                                       const string &unit,
+                                       const unordered_set<string> &relink);
+
+        void _addLocalDefinitions(const string &unit, SymbolMap &defs);
+
+        void _linkSymbols(const string &unit, const SymbolMap &defs);
+
+        unordered_map<string, string> _headersToSources();
+
+        void _relink(const unordered_set<string> &units, unsigned int threads);
+
+        // Links on `threads` threads, 0 for all hardware threads.
+        void crossLink(unsigned int threads = 1);
+
+        // Relinks only the units a scan could have affected: changed units,
+        // units that lost links, and everything importing them. Returns the
+        // number of relinked units.
+        size_t crossLink(const IndexDelta &delta, unsigned int threads = 1);
 
         vector<shared_ptr<Coordinate>> findUsages(Coordinate coord);
+
+        EngineStats stats();
+
+        // Writes the indexed and cross-linked state to `file`. `workspace`
+        // identifies what was indexed and must match again on load.
+        bool saveIndex(const string &file, const string &workspace);
+
+        // Replaces the engine state with a snapshot written by saveIndex. The
+        // engine is left untouched unless SNAPSHOT_LOADED is returned. An empty
+        // `workspace` accepts any snapshot. Units are not checked against their
+        // files; a scan afterwards reparses what changed since the save. Open
+        // documents are laid over the loaded units again.
+        SnapshotResult loadIndex(const string &file, const string &workspace);
     };
 }
 
@@ -4,10 +4,15 @@
 #include <tree_sitter/api.h>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <unordered_map>
+#include <mutex>
 #include <regex>
+#include <string-interner.h>
+#include <source-buffer.h>
 
 using std::shared_ptr;
 using std::string;
@@ -42,30 +47,206 @@ namespace stack_graph
         IMPORT
     };
 
+    typedef uint32_t NodeId;
+
+    const NodeId NO_NODE = UINT32_MAX;
+
+    // Scopes with more children than this get a symbol index on first lookup.
+    const size_t WIDE_SCOPE = 32;
+
+    struct StackGraphNode;
+    struct StackGraphTree;
+    struct ChildRange;
+
+    // Handle to a node stored in a StackGraphTree arena. Handles stay valid
+    // while the tree grows, unlike StackGraphNode pointers and references.
+    struct NodeRef
+    {
+        StackGraphTree *tree;
+        NodeId id;
+
+        NodeRef() : tree(nullptr), id(NO_NODE) {}
+
+        NodeRef(std::nullptr_t) : tree(nullptr), id(NO_NODE) {}
+
+        NodeRef(StackGraphTree *tree, NodeId id) : tree(tree), id(id) {}
+
+        bool operator==(const NodeRef &other) const
+        {
+            return tree == other.tree && id == other.id;
+        }
+
+        bool operator!=(const NodeRef &other) const
+        {
+            return !(*this == other);
+        }
+
+        StackGraphNode *operator->() const;
+
+        StackGraphNode &operator*() const;
+
+        NodeRef parent() const;
+
+        // The root of the node's tree. Its symbol is the unit's path.
+        NodeRef root() const
+        {
+            return NodeRef(tree, 0);
+        }
+
+        ChildRange children() const;
+
+        std::string_view symbolText() const;
+
+        std::string_view typeText() const;
+
+        string repr() const;
+    };
+
     struct StackGraphNode
     {
-        string symbol;
-        string _type;
+        SymbolId symbol;
+        SymbolId _type;
         StackGraphNodeKind kind;
-        shared_ptr<StackGraphNode> jump_to;
-        vector<shared_ptr<StackGraphNode>> children;
-        shared_ptr<StackGraphNode> parent;
         Point location;
+        // Where the node sits among the usages of jump_to; kept by
+        // UsageIndex, and free in the padding before jump_to.
+        uint32_t usage_slot;
+        NodeRef jump_to;
+        NodeId parent;
+        NodeId first_child;
+        NodeId last_child;
+        NodeId next_sibling;
 
-        StackGraphNode(StackGraphNodeKind kind, string symbol, Point location)
+        StackGraphNode(StackGraphNodeKind kind, SymbolId symbol, Point location)
         {
             this->symbol = symbol;
             this->kind = kind;
-            this->_type = "";
+            this->_type = EMPTY_SYMBOL;
             this->location = location;
-            this->children = vector<shared_ptr<StackGraphNode>>();
-            this->parent = nullptr;
+            this->usage_slot = 0;
+            this->parent = NO_NODE;
+            this->first_child = NO_NODE;
+            this->last_child = NO_NODE;
+            this->next_sibling = NO_NODE;
         }
+    };
+
+    // All nodes of one translation unit, root first. Nodes are appended in
+    // preorder, so walking the arena front to back visits the tree depth first.
+    struct StackGraphTree
+    {
+        vector<StackGraphNode> nodes;
+        StringInterner *symbols;
+        SourceStamp source = {0, 0, 0};
+        // First child of each symbol, for the wide scopes looked up so far.
+        std::unordered_map<NodeId, std::unordered_map<SymbolId, NodeId>> wide_scopes;
+        std::mutex wide_scopes_mutex;
+
+        StackGraphTree(StringInterner *symbols) : symbols(symbols) {}
+
+        NodeRef root()
+        {
+            return NodeRef(this, 0);
+        }
+
+        NodeId add(StackGraphNodeKind kind, SymbolId symbol, Point location, NodeId parent);
+
+        // The first child of `scope` named `symbol`, or NO_NODE. Scans the
+        // first WIDE_SCOPE children and indexes the scope if it is wider.
+        NodeId findChild(NodeId scope, SymbolId symbol);
+
+        size_t memoryUsage();
 
         string repr();
     };
 
-    std::shared_ptr<StackGraphNode> build_stack_graph_tree(TSNode root, const char *source_code);
+    struct ChildRange
+    {
+        struct iterator
+        {
+            StackGraphTree *tree;
+            NodeId id;
+
+            NodeRef operator*() const
+            {
+                return NodeRef(tree, id);
+            }
+
+            iterator &operator++()
+            {
+                id = tree->nodes[id].next_sibling;
+                return *this;
+            }
+
+            bool operator!=(const iterator &other) const
+            {
+                return id != other.id;
+            }
+        };
+
+        StackGraphTree *tree;
+        NodeId first;
+
+        iterator begin() const
+        {
+            return {tree, first};
+        }
+
+        iterator end() const
+        {
+            return {tree, NO_NODE};
+        }
+    };
+
+    inline StackGraphNode *NodeRef::operator->() const
+    {
+        return &tree->nodes[id];
+    }
+
+    inline StackGraphNode &NodeRef::operator*() const
+    {
+        return tree->nodes[id];
+    }
+
+    inline NodeRef NodeRef::parent() const
+    {
+        auto p = tree->nodes[id].parent;
+        return p == NO_NODE ? NodeRef() : NodeRef(tree, p);
+    }
+
+    inline ChildRange NodeRef::children() const
+    {
+        return {tree, tree->nodes[id].first_child};
+    }
+
+    inline std::string_view NodeRef::symbolText() const
+    {
+        return tree->symbols->text(tree->nodes[id].symbol);
+    }
+
+    inline std::string_view NodeRef::typeText() const
+    {
+        return tree->symbols->text(tree->nodes[id]._type);
+    }
+
+    // Both builders produce identical trees. The recursive one is kept to
+    // check the cursor builder against.
+    enum StackGraphBuilder
+    {
+        CURSOR_BUILDER,
+        RECURSIVE_BUILDER
+    };
+
+    std::shared_ptr<StackGraphTree> build_stack_graph_tree(TSNode root, std::string_view source_code, StringInterner &symbols, StackGraphBuilder builder = CURSOR_BUILDER);
 }
 
+template <>
+struct std::hash<stack_graph::NodeRef>
+{
+    std::size_t operator()(const stack_graph::NodeRef &k) const
+    {
+        return std::hash<void *>{}(k.tree) * 31 + k.id;
+    }
+};
+
 #endif
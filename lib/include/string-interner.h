@@ -0,0 +1,76 @@
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+using std::string;
+
+#ifndef STRING_INTERNER_H
+#define STRING_INTERNER_H
+
+namespace stack_graph
+{
+    typedef uint32_t SymbolId;
+
+    const SymbolId EMPTY_SYMBOL = 0;
+    const SymbolId NO_SYMBOL = UINT32_MAX;
+
+    struct InternerStats
+    {
+        size_t size;
+        size_t bytes;
+        size_t lookups;
+        size_t hits;
+    };
+
+    // Maps strings to dense ids, starting with "" as EMPTY_SYMBOL. intern and
+    // find may be called from several threads at once; text never blocks.
+    struct StringInterner
+    {
+        static const size_t SHARDS = 32;
+        static const size_t CHUNK_BITS = 12;
+        static const size_t MAX_CHUNKS = 1 << 16;
+
+        struct Shard
+        {
+            std::mutex mutex;
+            std::unordered_map<std::string_view, SymbolId> ids;
+            size_t lookups = 0;
+            size_t hits = 0;
+        };
+
+        Shard shards[SHARDS];
+        std::mutex append_mutex;
+        std::unique_ptr<std::atomic<string *>[]> chunks;
+        std::atomic<SymbolId> count{0};
+        size_t bytes = 0;
+
+        StringInterner();
+
+        StringInterner(const StringInterner &) = delete;
+
+        StringInterner &operator=(const StringInterner &) = delete;
+
+        ~StringInterner();
+
+        SymbolId intern(std::string_view text);
+
+        SymbolId find(std::string_view text);
+
+        std::string_view text(SymbolId id) const
+        {
+            return chunks[id >> CHUNK_BITS].load(std::memory_order_acquire)[id & ((1 << CHUNK_BITS) - 1)];
+        }
+
+        size_t size() const
+        {
+            return count.load();
+        }
+
+        InternerStats stats();
+    };
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include <memory>
+#include <vector>
+#include <functional>
+#include <stack-graph-tree.h>
+
+using std::shared_ptr;
+using std::vector;
+
+#ifndef SYMBOL_MAP_H
+#define SYMBOL_MAP_H
+
+namespace stack_graph
+{
+    // A persistent map from symbols to nodes: a hash array mapped trie keyed
+    // by the bits of the symbol id. Copies are O(1) and share every node;
+    // a node is copied only when a map that does not own it alone changes
+    // it, so merging a map into one it mostly overlaps costs the part that
+    // differs rather than the size of either.
+    struct SymbolMap
+    {
+        struct Node;
+
+        struct Slot
+        {
+            SymbolId key;
+            NodeRef value;
+            // Set when the slot holds a subtrie rather than an entry.
+            shared_ptr<Node> child;
+        };
+
+        struct Node
+        {
+            uint32_t bitmap = 0;
+            // Entries in the subtrie.
+            size_t size = 0;
+            vector<Slot> slots;
+        };
+
+        shared_ptr<Node> root;
+
+        // Adds the entry unless the map has `key` already.
+        bool insert(SymbolId key, NodeRef value);
+
+        // Adds the entry or replaces the value of `key`.
+        void assign(SymbolId key, NodeRef value);
+
+        // Adds every entry of `other` whose key the map does not have.
+        void merge(const SymbolMap &other);
+
+        // The value of `key`, or null.
+        const NodeRef *find(SymbolId key) const;
+
+        void forEach(std::function<void(SymbolId, NodeRef)> cbk) const;
+
+        size_t size() const
+        {
+            return root ? root->size : 0;
+        }
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,54 @@
+#include <vector>
+#include <unordered_map>
+#include <stack-graph-tree.h>
+
+using std::unordered_map;
+using std::vector;
+
+#ifndef USAGE_INDEX_H
+#define USAGE_INDEX_H
+
+namespace stack_graph
+{
+    // Maps every node some jump_to points at back to the nodes pointing at
+    // it, so the usages of a definition are a single lookup. Links made
+    // while building a tree are added with the tree; the engine changes
+    // every later link through jump(). Each node keeps its place in its
+    // target's list, so moving a link costs the same however many nodes
+    // share the target.
+    struct UsageIndex
+    {
+        unordered_map<NodeRef, vector<NodeRef>> usages;
+        size_t count = 0;
+        // Bumped by every jump and never reset, so results derived from the
+        // links can tell they are stale.
+        size_t jumps = 0;
+
+        // Points `node` at `target`, which may be null, and moves its entry.
+        void jump(NodeRef node, NodeRef target);
+
+        // Adds the links of every node of `tree`, whatever they point at.
+        void insert(StackGraphTree &tree);
+
+        // Drops the links out of `tree` and the entries of its nodes.
+        void erase(StackGraphTree &tree);
+
+        // The nodes pointing at `target`, in no particular order.
+        const vector<NodeRef> &find(NodeRef target) const;
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        void clear();
+
+        size_t memoryUsage() const;
+
+        void _add(NodeRef node, NodeRef target);
+
+        void _remove(NodeRef node, NodeRef target);
+    };
+}
+
+#endif
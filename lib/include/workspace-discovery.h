@@ -0,0 +1,41 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include <path-filter.h>
+
+using std::string;
+using std::vector;
+
+#ifndef WORKSPACE_DISCOVERY_H
+#define WORKSPACE_DISCOVERY_H
+
+namespace stack_graph
+{
+    struct DiscoveredFile
+    {
+        string path;
+        dev_t device;
+        ino_t inode;
+    };
+
+    struct FileStream
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<DiscoveredFile> queue;
+        bool closed = false;
+
+        void push(DiscoveredFile file);
+
+        void close();
+
+        bool pop(DiscoveredFile &file);
+    };
+
+    void discoverSourceFiles(const string &root, const PathFilter &filter, unsigned int threads, bool follow_symlinks, FileStream &out);
+}
+
+#endif
@@ -0,0 +1,218 @@
+#include <compile-database.h>
+#include <json.hpp>
+#include <fstream>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+using stack_graph::CompileDatabase;
+
+// Splits a command line the way a POSIX shell would, minus expansions.
+static vector<string> _split_command(const string &command)
+{
+    vector<string> args;
+    string current;
+    bool in_arg = false;
+    char quote = 0;
+    for (size_t i = 0; i < command.size(); i++)
+    {
+        char c = command[i];
+        if (quote == '\'')
+        {
+            if (c == '\'')
+            {
+                quote = 0;
+            }
+            else
+            {
+                current += c;
+            }
+        }
+        else if (c == '\\' && i + 1 < command.size())
+        {
+            current += command[++i];
+            in_arg = true;
+        }
+        else if (quote == '"')
+        {
+            if (c == '"')
+            {
+                quote = 0;
+            }
+            else
+            {
+                current += c;
+            }
+        }
+        else if (c == '\'' || c == '"')
+        {
+            quote = c;
+            in_arg = true;
+        }
+        else if (c == ' ' || c == '\t' || c == '\n')
+        {
+            if (in_arg)
+            {
+                args.push_back(std::move(current));
+                current.clear();
+                in_arg = false;
+            }
+        }
+        else
+        {
+            current += c;
+            in_arg = true;
+        }
+    }
+    if (in_arg)
+    {
+        args.push_back(std::move(current));
+    }
+    return args;
+}
+
+static string _absolute(const string &directory, const string &path)
+{
+    return (fs::path(directory) / path).lexically_normal().string();
+}
+
+bool CompileDatabase::load(const string &file)
+{
+    this->clear();
+
+    nlohmann::json commands;
+    try
+    {
+        std::ifstream in(file);
+        commands = nlohmann::json::parse(in);
+    }
+    catch (nlohmann::json::exception &)
+    {
+        return false;
+    }
+    if (!commands.is_array())
+    {
+        return false;
+    }
+
+    const char *flags[] = {"-iquote", "-I", "-isystem", "-idirafter"};
+    for (auto &command : commands)
+    {
+        if (!command.is_object() || !command.contains("file") || !command["file"].is_string())
+        {
+            continue;
+        }
+        auto directory = command.value("directory", string());
+        auto source = _absolute(directory, command["file"].get<string>());
+
+        vector<string> args;
+        if (command.contains("arguments") && command["arguments"].is_array())
+        {
+            for (auto &arg : command["arguments"])
+            {
+                if (arg.is_string())
+                {
+                    args.push_back(arg.get<string>());
+                }
+            }
+        }
+        else if (command.contains("command") && command["command"].is_string())
+        {
+            args = _split_command(command["command"].get<string>());
+        }
+
+        // One pass per flag keeps the compiler's search order.
+        vector<string> search;
+        for (auto flag : flags)
+        {
+            string prefix(flag);
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                if (args[i] == prefix && i + 1 < args.size())
+                {
+                    search.push_back(_absolute(directory, args[++i]));
+                }
+                else if (args[i].size() > prefix.size() && args[i].compare(0, prefix.size(), prefix) == 0 && (prefix != "-I" || args[i][2] != '-'))
+                {
+                    search.push_back(_absolute(directory, args[i].substr(prefix.size())));
+                }
+            }
+        }
+
+        string key;
+        for (auto &dir : search)
+        {
+            key += dir;
+            key += '\0';
+        }
+        auto found = this->search_ids.find(key);
+        if (found == this->search_ids.end())
+        {
+            found = this->search_ids.insert({key, (uint32_t)this->searches.size()}).first;
+            this->searches.push_back(std::move(search));
+        }
+
+        if (this->units.find(source) == this->units.end())
+        {
+            this->units[source] = this->_context(fs::path(source).parent_path().string(), found->second);
+            this->sources.push_back(source);
+        }
+    }
+    return true;
+}
+
+uint32_t CompileDatabase::_context(const string &directory, uint32_t search)
+{
+    auto key = std::to_string(search) + '\0' + directory;
+    auto found = this->context_ids.find(key);
+    if (found == this->context_ids.end())
+    {
+        found = this->context_ids.insert({key, (uint32_t)this->contexts.size()}).first;
+        this->contexts.push_back({directory, search});
+    }
+    return found->second;
+}
+
+uint32_t CompileDatabase::contextOf(const string &path) const
+{
+    auto found = this->units.find(path);
+    return found == this->units.end() ? stack_graph::NAME_CONTEXT : found->second;
+}
+
+uint32_t CompileDatabase::derive(uint32_t context, const string &header)
+{
+    if (context == stack_graph::NAME_CONTEXT)
+    {
+        return context;
+    }
+    return this->_context(fs::path(header).parent_path().string(), this->contexts[context].search);
+}
+
+string CompileDatabase::resolve(uint32_t context, const string &spelling, std::function<bool(const string &)> exists) const
+{
+    auto &ctx = this->contexts[context];
+    auto candidate = _absolute(ctx.directory, spelling);
+    if (exists(candidate))
+    {
+        return candidate;
+    }
+    for (auto &dir : this->searches[ctx.search])
+    {
+        candidate = _absolute(dir, spelling);
+        if (exists(candidate))
+        {
+            return candidate;
+        }
+    }
+    return "";
+}
+
+void CompileDatabase::clear()
+{
+    this->searches.clear();
+    this->contexts = {{"", 0}};
+    this->search_ids.clear();
+    this->context_ids.clear();
+    this->sources.clear();
+    this->units.clear();
+}
@@ -0,0 +1,255 @@
+#include <file-watcher.h>
+#include <set>
+#include <chrono>
+#include <utility>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+using stack_graph::FileWatcher;
+
+const uint32_t _WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR;
+
+FileWatcher::FileWatcher(const string &root, const vector<string> &excludes, bool follow_symlinks)
+    : root(root), filter(excludes), follow_symlinks(follow_symlinks)
+{
+    while (this->root.size() > 1 && this->root.back() == '/')
+    {
+        this->root.pop_back();
+    }
+}
+
+FileWatcher::~FileWatcher()
+{
+    if (this->fd >= 0)
+    {
+        close(this->fd);
+    }
+    for (int end : this->wake)
+    {
+        if (end >= 0)
+        {
+            close(end);
+        }
+    }
+}
+
+bool FileWatcher::start()
+{
+    this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->fd < 0 || pipe2(this->wake, O_NONBLOCK | O_CLOEXEC) != 0)
+    {
+        return false;
+    }
+
+    this->_watchTree(this->root);
+    return !this->out_of_watches && !this->directories.empty();
+}
+
+void FileWatcher::_watchTree(const string &dir)
+{
+    std::set<std::pair<dev_t, ino_t>> visited;
+    vector<string> pending = {dir};
+
+    while (!pending.empty())
+    {
+        auto current = std::move(pending.back());
+        pending.pop_back();
+
+        struct stat st;
+        if (stat(current.c_str(), &st) != 0 || !visited.insert({st.st_dev, st.st_ino}).second)
+        {
+            continue;
+        }
+
+        int wd = inotify_add_watch(this->fd, current.c_str(), _WATCH_MASK | (this->follow_symlinks ? 0 : IN_DONT_FOLLOW));
+        if (wd < 0)
+        {
+            this->out_of_watches = true;
+            continue;
+        }
+        this->directories[wd] = current;
+
+        DIR *d = opendir(current.c_str());
+        if (d == nullptr)
+        {
+            continue;
+        }
+        while (auto entry = readdir(d))
+        {
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+
+            string path = current + "/" + name;
+            bool is_dir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN || (entry->d_type == DT_LNK && this->follow_symlinks))
+            {
+                struct stat child;
+                is_dir = stat(path.c_str(), &child) == 0 && S_ISDIR(child.st_mode);
+            }
+            if (is_dir && !this->filter.isExcluded(path + "/"))
+            {
+                pending.push_back(std::move(path));
+            }
+        }
+        closedir(d);
+    }
+}
+
+void FileWatcher::_unwatchTree(const string &dir)
+{
+    auto prefix = dir + "/";
+    for (auto it = this->directories.begin(); it != this->directories.end();)
+    {
+        if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0)
+        {
+            inotify_rm_watch(this->fd, it->first);
+            it = this->directories.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+// Drops paths that lie below another path of the batch.
+static void _fold_batch(std::set<string> &changed, vector<string> &paths)
+{
+    paths.clear();
+    for (auto &path : changed)
+    {
+        bool covered = false;
+        for (auto slash = path.rfind('/'); !covered && slash != string::npos && slash > 0; slash = path.rfind('/', slash - 1))
+        {
+            covered = changed.count(path.substr(0, slash)) > 0;
+        }
+        if (!covered)
+        {
+            paths.push_back(path);
+        }
+    }
+}
+
+bool FileWatcher::nextBatch(vector<string> &paths, unsigned int debounce_ms)
+{
+    using clock = std::chrono::steady_clock;
+
+    std::set<string> changed;
+    alignas(struct inotify_event) char buffer[65536];
+    clock::time_point first, last;
+
+    while (true)
+    {
+        int timeout = -1;
+        if (!changed.empty())
+        {
+            auto now = clock::now();
+            auto quiet = last + std::chrono::milliseconds(debounce_ms);
+            auto latest = first + std::chrono::milliseconds(10 * debounce_ms);
+            auto until = std::min(quiet, latest);
+            if (now >= until)
+            {
+                break;
+            }
+            timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count() + 1;
+        }
+
+        struct pollfd fds[2] = {{this->fd, POLLIN, 0}, {this->wake[0], POLLIN, 0}};
+        int ready = poll(fds, 2, timeout);
+        if (ready < 0)
+        {
+            continue;
+        }
+        if (fds[1].revents & POLLIN)
+        {
+            return false;
+        }
+        if (!(fds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        ssize_t n;
+        while ((n = read(this->fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *p = buffer; p < buffer + n;)
+            {
+                auto event = reinterpret_cast<struct inotify_event *>(p);
+                p += sizeof(struct inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    // Events were lost: rescan everything.
+                    changed.insert(this->root);
+                    continue;
+                }
+
+                auto dir = this->directories.find(event->wd);
+                if (dir == this->directories.end())
+                {
+                    continue;
+                }
+                if (event->mask & IN_IGNORED)
+                {
+                    this->directories.erase(dir);
+                    continue;
+                }
+                if (event->len == 0)
+                {
+                    changed.insert(dir->second);
+                    continue;
+                }
+
+                string path = dir->second + "/" + event->name;
+                if (event->mask & IN_ISDIR)
+                {
+                    if (this->filter.isExcluded(path + "/"))
+                    {
+                        continue;
+                    }
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    {
+                        this->_watchTree(path);
+                    }
+                    else if (event->mask & IN_MOVED_FROM)
+                    {
+                        this->_unwatchTree(path);
+                    }
+                    changed.insert(path);
+                }
+                else if (stack_graph::isSourceFileName(event->name) && !this->filter.isExcluded(path))
+                {
+                    changed.insert(path);
+                }
+            }
+        }
+
+        if (!changed.empty())
+        {
+            last = clock::now();
+            if (first == clock::time_point())
+            {
+                first = last;
+            }
+        }
+    }
+
+    _fold_batch(changed, paths);
+    return true;
+}
+
+void FileWatcher::stop()
+{
+    if (this->wake[1] >= 0)
+    {
+        char byte = 1;
+        (void)!write(this->wake[1], &byte, 1);
+    }
+}
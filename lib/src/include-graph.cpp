@@ -0,0 +1,185 @@
+#include <include-graph.h>
+#include <algorithm>
+
+using stack_graph::IncludeGraph;
+
+static const vector<uint32_t> _NO_FILES;
+static const vector<stack_graph::SymbolId> _NO_SPELLINGS;
+
+void IncludeGraph::insert(uint32_t file, StackGraphTree &tree)
+{
+    if (file >= this->files.size())
+    {
+        this->files.resize(file + 1);
+    }
+
+    vector<SymbolId> spellings;
+    for (auto &node : tree.nodes)
+    {
+        if (node.kind == StackGraphNodeKind::IMPORT)
+        {
+            spellings.push_back(node.symbol);
+        }
+    }
+
+    auto &entry = this->files[file];
+    if (!entry.present)
+    {
+        this->resolved.clear();
+    }
+    if (!entry.present || entry.spellings != spellings)
+    {
+        this->stale = true;
+    }
+    entry.present = true;
+    entry.spellings = std::move(spellings);
+}
+
+void IncludeGraph::erase(uint32_t file)
+{
+    if (file >= this->files.size() || !this->files[file].present)
+    {
+        return;
+    }
+    this->files[file] = File();
+    this->resolved.clear();
+    this->stale = true;
+}
+
+// Marks files whose context is not known yet.
+const uint32_t _UNVISITED = UINT32_MAX;
+
+void IncludeGraph::update(const vector<std::pair<uint32_t, uint32_t>> &seeds,
+                          std::function<uint32_t(uint32_t, SymbolId)> resolve,
+                          std::function<uint32_t(uint32_t, uint32_t)> derive)
+{
+    if (!this->stale)
+    {
+        return;
+    }
+
+    for (auto &file : this->files)
+    {
+        file.includes.clear();
+        file.includers.clear();
+        file.targets.clear();
+        file.context = _UNVISITED;
+    }
+    this->edges = 0;
+
+    vector<uint32_t> order;
+    auto visit = [&](uint32_t id, uint32_t context)
+    {
+        if (id < this->files.size() && this->files[id].present && this->files[id].context == _UNVISITED)
+        {
+            this->files[id].context = context;
+            order.push_back(id);
+        }
+    };
+
+    auto link = [&](uint32_t id)
+    {
+        auto &file = this->files[id];
+        for (auto spelling : file.spellings)
+        {
+            auto key = (uint64_t)file.context << 32 | spelling;
+            auto found = this->resolved.find(key);
+            if (found == this->resolved.end())
+            {
+                found = this->resolved.insert({key, resolve(file.context, spelling)}).first;
+            }
+
+            auto target = found->second;
+            file.targets.push_back(target);
+            if (target == NO_FILE || target == id || std::find(file.includes.begin(), file.includes.end(), target) != file.includes.end())
+            {
+                continue;
+            }
+            file.includes.push_back(target);
+            this->files[target].includers.push_back(id);
+            this->edges++;
+        }
+    };
+
+    for (auto &seed : seeds)
+    {
+        visit(seed.first, seed.second);
+    }
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        link(order[i]);
+        for (auto target : this->files[order[i]].includes)
+        {
+            if (target < this->files.size() && this->files[target].context == _UNVISITED)
+            {
+                visit(target, derive(this->files[order[i]].context, target));
+            }
+        }
+    }
+
+    for (uint32_t id = 0; id < this->files.size(); id++)
+    {
+        if (this->files[id].present && this->files[id].context == _UNVISITED)
+        {
+            this->files[id].context = 0;
+            link(id);
+        }
+    }
+    this->stale = false;
+}
+
+vector<uint32_t> IncludeGraph::reachable(uint32_t file, bool includers) const
+{
+    vector<uint32_t> order;
+    if (file >= this->files.size())
+    {
+        return order;
+    }
+
+    vector<bool> seen(this->files.size());
+    seen[file] = true;
+    order.push_back(file);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        auto &next = includers ? this->files[order[i]].includers : this->files[order[i]].includes;
+        for (auto id : next)
+        {
+            if (!seen[id])
+            {
+                seen[id] = true;
+                order.push_back(id);
+            }
+        }
+    }
+    order.erase(order.begin());
+    return order;
+}
+
+const vector<stack_graph::SymbolId> &IncludeGraph::spellingsOf(uint32_t file) const
+{
+    return file < this->files.size() ? this->files[file].spellings : _NO_SPELLINGS;
+}
+
+const vector<uint32_t> &IncludeGraph::includesOf(uint32_t file) const
+{
+    return file < this->files.size() ? this->files[file].includes : _NO_FILES;
+}
+
+void IncludeGraph::clear()
+{
+    this->files.clear();
+    this->resolved.clear();
+    this->stale = false;
+    this->edges = 0;
+}
+
+size_t IncludeGraph::memoryUsage() const
+{
+    size_t bytes = this->files.capacity() * sizeof(File);
+    for (auto &file : this->files)
+    {
+        bytes += file.spellings.capacity() * sizeof(SymbolId) + (file.targets.capacity() + file.includes.capacity() + file.includers.capacity()) * sizeof(uint32_t);
+    }
+    bytes += this->resolved.bucket_count() * sizeof(void *) + this->resolved.size() * (sizeof(std::pair<const uint64_t, uint32_t>) + sizeof(void *));
+    return bytes;
+}
@@ -0,0 +1,497 @@
+#include <stack-graph-engine.h>
+#include <index-snapshot.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <fstream>
+#include <algorithm>
+
+using stack_graph::NO_NODE;
+using stack_graph::NodeId;
+using stack_graph::NodeRef;
+using stack_graph::Point;
+using stack_graph::SnapshotResult;
+using stack_graph::StackGraphEngine;
+using stack_graph::StackGraphNode;
+using stack_graph::StackGraphNodeKind;
+using stack_graph::StackGraphTree;
+using stack_graph::SymbolId;
+
+// A snapshot is a _SnapshotHeader followed by the tables (workspace, symbol
+// offsets and bytes, units, name_to_path, h_to_c, cross links) and then the
+// node arrays of all units. Sections are 8-byte aligned and hold plain
+// integers. Loading maps the file, validates every section and then copies
+// it out: nodes into fresh trees, symbols into the engine's interner, while
+// the node table, usages, references and include graph are rebuilt from the
+// trees. The header and the tables carry one checksum each and every unit one
+// for its nodes.
+
+const char SNAPSHOT_MAGIC[8] = {'C', 'L', 'S', 'I', 'N', 'D', 'E', 'X'};
+const uint32_t NO_UNIT = UINT32_MAX;
+
+struct _SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t file_size;
+    uint64_t header_checksum;
+    uint64_t tables_checksum;
+    uint64_t workspace_offset;
+    uint64_t workspace_size;
+    uint64_t symbol_count;
+    uint64_t symbol_offsets_offset;
+    uint64_t symbol_bytes_offset;
+    uint64_t symbol_bytes_size;
+    uint64_t unit_count;
+    uint64_t units_offset;
+    uint64_t name_to_path_count;
+    uint64_t name_to_path_offset;
+    uint64_t h_to_c_count;
+    uint64_t h_to_c_offset;
+    uint64_t cross_link_count;
+    uint64_t cross_links_offset;
+    uint64_t nodes_offset;
+};
+
+struct _SnapshotUnit
+{
+    uint32_t path;
+    uint32_t padding;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;
+    uint64_t first_node;
+    uint64_t node_count;
+    uint64_t checksum;
+};
+
+struct _SnapshotNode
+{
+    uint32_t symbol;
+    uint32_t type;
+    uint32_t kind;
+    uint32_t line;
+    uint32_t column;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t last_child;
+    uint32_t next_sibling;
+    uint32_t jump_unit;
+    uint32_t jump_node;
+};
+
+struct _SnapshotPair
+{
+    uint32_t first;
+    uint32_t second;
+};
+
+struct _SnapshotLink
+{
+    uint32_t symbol_unit;
+    uint32_t symbol_node;
+    uint32_t definition_unit;
+    uint32_t definition_node;
+    uint32_t previous_unit;
+    uint32_t previous_node;
+};
+
+void _align(string &buffer)
+{
+    buffer.resize((buffer.size() + 7) & ~(size_t)7, '\0');
+}
+
+template <typename T>
+uint64_t _append(string &buffer, const T *items, size_t count)
+{
+    _align(buffer);
+    uint64_t offset = buffer.size();
+    buffer.append(reinterpret_cast<const char *>(items), count * sizeof(T));
+    return offset;
+}
+
+const char *stack_graph::snapshotResultName(SnapshotResult result)
+{
+    switch (result)
+    {
+    case SNAPSHOT_LOADED:
+        return "loaded";
+    case SNAPSHOT_MISSING:
+        return "missing";
+    case SNAPSHOT_VERSION_MISMATCH:
+        return "version_mismatch";
+    case SNAPSHOT_CORRUPT:
+        return "corrupt";
+    case SNAPSHOT_STALE:
+        return "stale";
+    }
+    return "unknown";
+}
+
+bool StackGraphEngine::saveIndex(const string &file, const string &workspace)
+{
+    vector<string> paths;
+    for (auto &entry : this->translation_units)
+    {
+        paths.push_back(entry.first);
+    }
+    std::sort(paths.begin(), paths.end());
+
+    unordered_map<StackGraphTree *, uint32_t> unit_ids;
+    for (uint32_t u = 0; u < paths.size(); u++)
+    {
+        unit_ids[this->translation_units[paths[u]].get()] = u;
+    }
+
+    auto unit_of = [&](NodeRef ref)
+    {
+        return ref == nullptr ? NO_UNIT : unit_ids.at(ref.tree);
+    };
+
+    _SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = stack_graph::SNAPSHOT_VERSION;
+    header.header_size = sizeof(_SnapshotHeader);
+
+    // Everything up to the node arrays is built in memory; it is small next
+    // to the nodes, which are streamed one unit at a time.
+    string tables(sizeof(_SnapshotHeader), '\0');
+
+    // File names in name_to_path are interned here, before the symbol table
+    // is written, so every id in the snapshot has its text stored.
+    vector<_SnapshotPair> name_pairs, h_to_c_pairs;
+    for (auto &entry : this->name_to_path)
+    {
+        name_pairs.push_back({this->symbols.intern(entry.first), this->symbols.intern(entry.second)});
+    }
+    for (auto &entry : this->h_to_c)
+    {
+        h_to_c_pairs.push_back({this->symbols.intern(entry.first), this->symbols.intern(entry.second)});
+    }
+
+    header.workspace_offset = _append(tables, workspace.data(), workspace.size());
+    header.workspace_size = workspace.size();
+
+    header.symbol_count = this->symbols.size();
+    vector<uint64_t> symbol_offsets;
+    string symbol_bytes;
+    for (SymbolId id = 0; id < header.symbol_count; id++)
+    {
+        symbol_offsets.push_back(symbol_bytes.size());
+        symbol_bytes.append(this->symbols.text(id));
+    }
+    symbol_offsets.push_back(symbol_bytes.size());
+    header.symbol_offsets_offset = _append(tables, symbol_offsets.data(), symbol_offsets.size());
+    header.symbol_bytes_offset = _append(tables, symbol_bytes.data(), symbol_bytes.size());
+    header.symbol_bytes_size = symbol_bytes.size();
+
+    vector<_SnapshotUnit> units;
+    uint64_t node_total = 0;
+    for (auto &path : paths)
+    {
+        auto &tree = *this->translation_units[path];
+        _SnapshotUnit unit;
+        memset(&unit, 0, sizeof(unit));
+        unit.path = tree.nodes[0].symbol;
+        unit.size = tree.source.size;
+        unit.mtime_ns = tree.source.mtime_ns;
+        unit.hash = tree.source.hash;
+        unit.first_node = node_total;
+        unit.node_count = tree.nodes.size();
+        units.push_back(unit);
+        node_total += tree.nodes.size();
+    }
+    header.unit_count = units.size();
+    header.units_offset = _append(tables, units.data(), units.size());
+
+    header.name_to_path_count = name_pairs.size();
+    header.name_to_path_offset = _append(tables, name_pairs.data(), name_pairs.size());
+    header.h_to_c_count = h_to_c_pairs.size();
+    header.h_to_c_offset = _append(tables, h_to_c_pairs.data(), h_to_c_pairs.size());
+
+    vector<_SnapshotLink> links;
+    for (auto &link : this->cross_links)
+    {
+        links.push_back({unit_of(link.symbol), link.symbol.id, unit_of(link.definition), link.definition.id,
+                         unit_of(link.previous), link.previous.id});
+    }
+    header.cross_link_count = links.size();
+    header.cross_links_offset = _append(tables, links.data(), links.size());
+
+    _align(tables);
+    header.nodes_offset = tables.size();
+    header.file_size = header.nodes_offset + node_total * sizeof(_SnapshotNode);
+
+    // Written next to the target and renamed over it, so a reader never sees
+    // a half-written snapshot. The node arrays go first, one unit at a time,
+    // and the tables are filled in once their checksums are known.
+    auto tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.seekp(header.nodes_offset);
+
+        vector<_SnapshotNode> nodes;
+        for (uint32_t u = 0; u < paths.size(); u++)
+        {
+            nodes.clear();
+            for (auto &node : this->translation_units[paths[u]]->nodes)
+            {
+                nodes.push_back({node.symbol, node._type, (uint32_t)node.kind, node.location.line, node.location.column,
+                                 node.parent, node.first_child, node.last_child, node.next_sibling,
+                                 unit_of(node.jump_to), node.jump_to.id});
+            }
+            units[u].checksum = stack_graph::hashBytes(reinterpret_cast<const char *>(nodes.data()), nodes.size() * sizeof(_SnapshotNode));
+            out.write(reinterpret_cast<const char *>(nodes.data()), nodes.size() * sizeof(_SnapshotNode));
+        }
+
+        memcpy(&tables[header.units_offset], units.data(), units.size() * sizeof(_SnapshotUnit));
+        header.tables_checksum = stack_graph::hashBytes(tables.data() + sizeof(_SnapshotHeader), tables.size() - sizeof(_SnapshotHeader));
+        header.header_checksum = stack_graph::hashBytes(reinterpret_cast<const char *>(&header), sizeof(header));
+        memcpy(&tables[0], &header, sizeof(header));
+
+        out.seekp(0);
+        out.write(tables.data(), tables.size());
+        if (!out)
+        {
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+    return rename(tmp.c_str(), file.c_str()) == 0;
+}
+
+struct _MappedFile
+{
+    const char *data = nullptr;
+    size_t size = 0;
+
+    ~_MappedFile()
+    {
+        if (data != nullptr)
+        {
+            munmap(const_cast<char *>(data), size);
+        }
+    }
+
+    bool contains(uint64_t offset, uint64_t count, size_t item_size) const
+    {
+        return offset <= size && count <= (size - offset) / item_size;
+    }
+
+    template <typename T>
+    const T *at(uint64_t offset) const
+    {
+        return reinterpret_cast<const T *>(data + offset);
+    }
+};
+
+SnapshotResult StackGraphEngine::loadIndex(const string &file, const string &workspace)
+{
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return stack_graph::SNAPSHOT_MISSING;
+    }
+
+    _MappedFile mapped;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(_SnapshotHeader))
+    {
+        close(fd);
+        return stack_graph::SNAPSHOT_CORRUPT;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        return stack_graph::SNAPSHOT_CORRUPT;
+    }
+    mapped.data = static_cast<const char *>(addr);
+    mapped.size = st.st_size;
+
+    _SnapshotHeader header;
+    memcpy(&header, mapped.data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0)
+    {
+        return stack_graph::SNAPSHOT_CORRUPT;
+    }
+    if (header.version != stack_graph::SNAPSHOT_VERSION || header.header_size != sizeof(_SnapshotHeader))
+    {
+        return stack_graph::SNAPSHOT_VERSION_MISMATCH;
+    }
+
+    auto header_checksum = header.header_checksum;
+    header.header_checksum = 0;
+    if (header_checksum != stack_graph::hashBytes(reinterpret_cast<const char *>(&header), sizeof(header)) ||
+        header.file_size != mapped.size ||
+        header.nodes_offset < sizeof(_SnapshotHeader) ||
+        !mapped.contains(header.nodes_offset, 0, 1) ||
+        !mapped.contains(header.workspace_offset, header.workspace_size, 1) ||
+        header.symbol_count == UINT64_MAX ||
+        !mapped.contains(header.symbol_offsets_offset, header.symbol_count + 1, sizeof(uint64_t)) ||
+        !mapped.contains(header.symbol_bytes_offset, header.symbol_bytes_size, 1) ||
+        !mapped.contains(header.units_offset, header.unit_count, sizeof(_SnapshotUnit)) ||
+        !mapped.contains(header.name_to_path_offset, header.name_to_path_count, sizeof(_SnapshotPair)) ||
+        !mapped.contains(header.h_to_c_offset, header.h_to_c_count, sizeof(_SnapshotPair)) ||
+        !mapped.contains(header.cross_links_offset, header.cross_link_count, sizeof(_SnapshotLink)) ||
+        header.tables_checksum != stack_graph::hashBytes(mapped.data + sizeof(_SnapshotHeader), header.nodes_offset - sizeof(_SnapshotHeader)))
+    {
+        return stack_graph::SNAPSHOT_CORRUPT;
+    }
+
+    if (!workspace.empty() && std::string_view(mapped.at<char>(header.workspace_offset), header.workspace_size) != workspace)
+    {
+        return stack_graph::SNAPSHOT_STALE;
+    }
+
+    auto units = mapped.at<_SnapshotUnit>(header.units_offset);
+    auto symbol_offsets = mapped.at<uint64_t>(header.symbol_offsets_offset);
+    auto symbol_text = [&](uint32_t id)
+    {
+        return std::string_view(mapped.at<char>(header.symbol_bytes_offset) + symbol_offsets[id], symbol_offsets[id + 1] - symbol_offsets[id]);
+    };
+
+    for (uint64_t i = 0; i < header.symbol_count; i++)
+    {
+        if (symbol_offsets[i] > symbol_offsets[i + 1] || symbol_offsets[i + 1] > header.symbol_bytes_size)
+        {
+            return stack_graph::SNAPSHOT_CORRUPT;
+        }
+    }
+
+
+    vector<shared_ptr<StackGraphTree>> trees;
+    for (uint64_t u = 0; u < header.unit_count; u++)
+    {
+        trees.push_back(std::make_shared<StackGraphTree>(&this->symbols));
+    }
+
+    for (uint64_t u = 0; u < header.unit_count; u++)
+    {
+        auto &unit = units[u];
+        auto nodes_offset = header.nodes_offset + unit.first_node * sizeof(_SnapshotNode);
+        if (unit.path >= header.symbol_count || unit.node_count == 0 || unit.node_count >= NO_NODE ||
+            unit.first_node > mapped.size / sizeof(_SnapshotNode) ||
+            !mapped.contains(nodes_offset, unit.node_count, sizeof(_SnapshotNode)) ||
+            unit.checksum != stack_graph::hashBytes(mapped.data + nodes_offset, unit.node_count * sizeof(_SnapshotNode)))
+        {
+            return stack_graph::SNAPSHOT_CORRUPT;
+        }
+
+        auto valid_link = [&](uint32_t id)
+        {
+            return id == NO_NODE || id < unit.node_count;
+        };
+
+        auto &tree = *trees[u];
+        tree.source = {unit.size, unit.mtime_ns, unit.hash};
+        tree.nodes.reserve(unit.node_count);
+        auto nodes = mapped.at<_SnapshotNode>(nodes_offset);
+        for (uint64_t i = 0; i < unit.node_count; i++)
+        {
+            auto &n = nodes[i];
+            if (n.symbol >= header.symbol_count || n.type >= header.symbol_count || n.kind > StackGraphNodeKind::IMPORT ||
+                !valid_link(n.parent) || !valid_link(n.first_child) || !valid_link(n.last_child) || !valid_link(n.next_sibling) ||
+                (n.jump_unit != NO_UNIT && (n.jump_unit >= header.unit_count || n.jump_node >= units[n.jump_unit].node_count)))
+            {
+                return stack_graph::SNAPSHOT_CORRUPT;
+            }
+
+            // Snapshot symbol ids for now; remapped once everything checks out.
+            tree.nodes.emplace_back((StackGraphNodeKind)n.kind, n.symbol, Point{n.line, n.column});
+            auto &node = tree.nodes.back();
+            node._type = n.type;
+            node.parent = n.parent;
+            node.first_child = n.first_child;
+            node.last_child = n.last_child;
+            node.next_sibling = n.next_sibling;
+            node.jump_to = n.jump_unit == NO_UNIT ? NodeRef() : NodeRef(trees[n.jump_unit].get(), n.jump_node);
+        }
+    }
+
+    auto read_pairs = [&](uint64_t offset, uint64_t count, vector<std::pair<string, string>> &out)
+    {
+        auto pairs = mapped.at<_SnapshotPair>(offset);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (pairs[i].first >= header.symbol_count || pairs[i].second >= header.symbol_count)
+            {
+                return false;
+            }
+            out.emplace_back(symbol_text(pairs[i].first), symbol_text(pairs[i].second));
+        }
+        return true;
+    };
+
+    vector<std::pair<string, string>> name_to_path, h_to_c;
+    if (!read_pairs(header.name_to_path_offset, header.name_to_path_count, name_to_path) ||
+        !read_pairs(header.h_to_c_offset, header.h_to_c_count, h_to_c))
+    {
+        return stack_graph::SNAPSHOT_CORRUPT;
+    }
+
+    auto valid_ref = [&](uint32_t unit, uint32_t node)
+    {
+        return unit < header.unit_count && node < units[unit].node_count;
+    };
+
+    vector<CrossLink> cross_links;
+    auto links = mapped.at<_SnapshotLink>(header.cross_links_offset);
+    for (uint64_t i = 0; i < header.cross_link_count; i++)
+    {
+        auto &l = links[i];
+        if (!valid_ref(l.symbol_unit, l.symbol_node) || !valid_ref(l.definition_unit, l.definition_node) ||
+            (l.previous_unit != NO_UNIT && !valid_ref(l.previous_unit, l.previous_node)))
+        {
+            return stack_graph::SNAPSHOT_CORRUPT;
+        }
+        auto previous = l.previous_unit == NO_UNIT ? NodeRef() : NodeRef(trees[l.previous_unit].get(), l.previous_node);
+        cross_links.push_back(CrossLink(NodeRef(trees[l.symbol_unit].get(), l.symbol_node), NodeRef(trees[l.definition_unit].get(), l.definition_node), previous));
+    }
+
+    // Every section is valid: only now may the engine's interner grow.
+    vector<SymbolId> remap(header.symbol_count);
+    for (uint64_t i = 0; i < header.symbol_count; i++)
+    {
+        remap[i] = this->symbols.intern(symbol_text(i));
+    }
+    for (auto &tree : trees)
+    {
+        for (auto &node : tree->nodes)
+        {
+            node.symbol = remap[node.symbol];
+            node._type = remap[node._type];
+        }
+    }
+
+    this->translation_units.clear();
+    this->node_table.clear();
+    this->usages.clear();
+    this->references.clear();
+    this->includes.clear();
+    this->resolutions.clear();
+    this->name_to_path.clear();
+    this->h_to_c.clear();
+    for (uint64_t u = 0; u < header.unit_count; u++)
+    {
+        this->addTranslationUnit(string(symbol_text(units[u].path)), trees[u]);
+    }
+    this->name_to_path.insert(name_to_path.begin(), name_to_path.end());
+    this->h_to_c.insert(h_to_c.begin(), h_to_c.end());
+    this->cross_links = std::move(cross_links);
+    this->_updateIncludeGraph();
+
+    // Open documents stand in for their files again, over the units just
+    // loaded from disk.
+    for (auto &entry : this->documents)
+    {
+        entry.second.indexed = entry.second.indexed || this->translation_units.count(entry.first) > 0;
+        this->_updateDocument(entry.first, entry.second);
+    }
+
+    return stack_graph::SNAPSHOT_LOADED;
+}
@@ -0,0 +1,130 @@
+#include <node-table.h>
+#include <algorithm>
+
+using stack_graph::NodeRef;
+using stack_graph::NodeTable;
+
+uint32_t NodeTable::insert(const string &path, StackGraphTree &tree)
+{
+    auto found = this->file_ids.find(path);
+    if (found == this->file_ids.end())
+    {
+        found = this->file_ids.insert({path, (uint32_t)this->files.size()}).first;
+        this->files.push_back({path, nullptr, {}, {}});
+    }
+
+    auto &file = this->files[found->second];
+    this->count -= file.entries.size();
+    if (file.tree != nullptr)
+    {
+        this->tree_ids.erase(file.tree);
+    }
+    this->tree_ids[&tree] = found->second;
+    file.tree = &tree;
+    file.entries.clear();
+    file.shadowed.clear();
+    file.entries.reserve(tree.nodes.size());
+    for (NodeId id = 0; id < tree.nodes.size(); id++)
+    {
+        file.entries.push_back({tree.nodes[id].location.line, tree.nodes[id].location.column, id});
+    }
+
+    // Ties keep node order, so the last node of a run is the one to keep.
+    std::stable_sort(file.entries.begin(), file.entries.end(), [](const Entry &a, const Entry &b)
+                     { return a.line != b.line ? a.line < b.line : a.column < b.column; });
+    size_t kept = 0;
+    for (size_t i = 0; i < file.entries.size(); i++)
+    {
+        if (i + 1 < file.entries.size() && file.entries[i + 1].line == file.entries[i].line && file.entries[i + 1].column == file.entries[i].column)
+        {
+            file.shadowed.push_back(file.entries[i].id);
+            continue;
+        }
+        file.entries[kept++] = file.entries[i];
+    }
+    file.entries.resize(kept);
+    file.entries.shrink_to_fit();
+    std::sort(file.shadowed.begin(), file.shadowed.end());
+    file.shadowed.shrink_to_fit();
+    this->count += kept;
+    return found->second;
+}
+
+void NodeTable::erase(const string &path)
+{
+    auto found = this->file_ids.find(path);
+    if (found == this->file_ids.end())
+    {
+        return;
+    }
+
+    // The id is kept for when the file comes back.
+    auto &file = this->files[found->second];
+    this->count -= file.entries.size();
+    this->tree_ids.erase(file.tree);
+    file.tree = nullptr;
+    file.entries.clear();
+    file.entries.shrink_to_fit();
+    file.shadowed.clear();
+    file.shadowed.shrink_to_fit();
+}
+
+NodeRef NodeTable::find(const string &path, uint32_t line, uint32_t column) const
+{
+    auto found = this->file_ids.find(path);
+    if (found == this->file_ids.end())
+    {
+        return NodeRef();
+    }
+
+    return this->find(found->second, line, column);
+}
+
+bool NodeTable::visible(uint32_t file_id, NodeId id) const
+{
+    auto &shadowed = this->files[file_id].shadowed;
+    return !std::binary_search(shadowed.begin(), shadowed.end(), id);
+}
+
+uint32_t NodeTable::fileOf(const StackGraphTree *tree) const
+{
+    auto found = this->tree_ids.find(tree);
+    return found == this->tree_ids.end() ? stack_graph::NO_FILE : found->second;
+}
+
+NodeRef NodeTable::find(uint32_t file_id, uint32_t line, uint32_t column) const
+{
+    auto &file = this->files[file_id];
+    auto it = std::lower_bound(file.entries.begin(), file.entries.end(), std::make_pair(line, column), [](const Entry &e, const std::pair<uint32_t, uint32_t> &key)
+                               { return e.line != key.first ? e.line < key.first : e.column < key.second; });
+    if (it == file.entries.end() || it->line != line || it->column != column)
+    {
+        return NodeRef();
+    }
+    return NodeRef(file.tree, it->id);
+}
+
+void NodeTable::clear()
+{
+    this->file_ids.clear();
+    this->tree_ids.clear();
+    this->files.clear();
+    this->count = 0;
+}
+
+size_t NodeTable::memoryUsage() const
+{
+    size_t bytes = this->files.capacity() * sizeof(File);
+    for (auto &file : this->files)
+    {
+        bytes += file.entries.capacity() * sizeof(Entry) + file.shadowed.capacity() * sizeof(NodeId) + file.path.capacity();
+    }
+    // Buckets plus one node per entry, with its copy of the path.
+    bytes += this->file_ids.bucket_count() * sizeof(void *);
+    for (auto &entry : this->file_ids)
+    {
+        bytes += sizeof(entry) + sizeof(void *) + entry.first.capacity();
+    }
+    bytes += this->tree_ids.bucket_count() * sizeof(void *) + this->tree_ids.size() * (sizeof(std::pair<const StackGraphTree *, uint32_t>) + sizeof(void *));
+    return bytes;
+}
@@ -0,0 +1,44 @@
+#include <path-filter.h>
+
+using stack_graph::PathFilter;
+
+bool stack_graph::isSourceFileName(const string &file)
+{
+    static const RE2 regex("[a-z0-9\\-_]*\\.(c|h)");
+    return RE2::FullMatch(file, regex);
+}
+
+bool stack_graph::isCFileName(const string &file)
+{
+    static const RE2 regex("[a-z0-9\\-_]*\\.c");
+    return RE2::FullMatch(file, regex);
+}
+
+bool stack_graph::isHeaderFileName(const string &file)
+{
+    static const RE2 regex("[a-z0-9\\-_]*\\.h");
+    return RE2::FullMatch(file, regex);
+}
+
+PathFilter::PathFilter(const vector<string> &excludes) : excludes(RE2::DefaultOptions, RE2::UNANCHORED)
+{
+    this->has_excludes = false;
+    for (auto &pattern : excludes)
+    {
+        // A pattern that does not compile could never match, same as RE2::PartialMatch.
+        if (this->excludes.Add(pattern, nullptr) >= 0)
+        {
+            this->has_excludes = true;
+        }
+    }
+
+    if (this->has_excludes)
+    {
+        this->has_excludes = this->excludes.Compile();
+    }
+}
+
+bool PathFilter::isExcluded(const string &path) const
+{
+    return this->has_excludes && this->excludes.Match(path, nullptr);
+}
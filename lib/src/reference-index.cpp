@@ -0,0 +1,138 @@
+#include <reference-index.h>
+#include <algorithm>
+#include <iterator>
+
+using stack_graph::ReferenceIndex;
+using stack_graph::SymbolId;
+
+static bool _by_segment(const ReferenceIndex::Entry &a, const ReferenceIndex::Entry &b)
+{
+    return a.segment != b.segment ? a.segment < b.segment : a.node < b.node;
+}
+
+void ReferenceIndex::insert(uint32_t file_id, StackGraphTree &tree)
+{
+    if (file_id >= this->files.size())
+    {
+        this->files.resize(file_id + 1);
+    }
+
+    auto &file = this->files[file_id];
+    this->count -= file.entries.size();
+    file.tree = &tree;
+    file.entries.clear();
+    for (NodeId id = 0; id < tree.nodes.size(); id++)
+    {
+        if (tree.nodes[id].kind != StackGraphNodeKind::REFERENCE)
+        {
+            continue;
+        }
+
+        auto text = tree.symbols->text(tree.nodes[id].symbol);
+        uint32_t position = 0;
+        size_t begin = 0;
+        while (begin <= text.size())
+        {
+            auto end = text.find('.', begin);
+            if (end == std::string_view::npos)
+            {
+                end = text.size();
+            }
+            if (end > begin)
+            {
+                file.entries.push_back({tree.symbols->intern(text.substr(begin, end - begin)), id, position});
+            }
+            position++;
+            begin = end + 1;
+        }
+    }
+
+    // Stable, so the first position of a repeated segment comes first.
+    std::stable_sort(file.entries.begin(), file.entries.end(), _by_segment);
+    file.entries.erase(std::unique(file.entries.begin(), file.entries.end(), [](const Entry &a, const Entry &b)
+                                   { return a.segment == b.segment && a.node == b.node; }),
+                       file.entries.end());
+    file.entries.shrink_to_fit();
+    this->count += file.entries.size();
+
+    vector<SymbolId> segments;
+    for (auto &entry : file.entries)
+    {
+        if (segments.empty() || segments.back() != entry.segment)
+        {
+            segments.push_back(entry.segment);
+        }
+    }
+    vector<SymbolId> added;
+    std::set_difference(segments.begin(), segments.end(), file.posted.begin(), file.posted.end(), std::back_inserter(added));
+    for (auto segment : added)
+    {
+        this->postings[segment].push_back(file_id);
+    }
+    if (!added.empty())
+    {
+        vector<SymbolId> posted;
+        std::set_union(file.posted.begin(), file.posted.end(), added.begin(), added.end(), std::back_inserter(posted));
+        file.posted = std::move(posted);
+    }
+}
+
+void ReferenceIndex::erase(uint32_t file_id)
+{
+    if (file_id >= this->files.size())
+    {
+        return;
+    }
+
+    auto &file = this->files[file_id];
+    this->count -= file.entries.size();
+    file.tree = nullptr;
+    file.entries.clear();
+    file.entries.shrink_to_fit();
+}
+
+vector<ReferenceIndex::Hit> ReferenceIndex::find(SymbolId segment) const
+{
+    vector<Hit> hits;
+    auto found = this->postings.find(segment);
+    if (found == this->postings.end())
+    {
+        return hits;
+    }
+
+    for (auto file_id : found->second)
+    {
+        auto &file = this->files[file_id];
+        auto range = std::equal_range(file.entries.begin(), file.entries.end(), Entry{segment, 0, 0},
+                                      [](const Entry &a, const Entry &b)
+                                      { return a.segment < b.segment; });
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            hits.push_back({file_id, NodeRef(file.tree, it->node), it->position});
+        }
+    }
+    return hits;
+}
+
+void ReferenceIndex::clear()
+{
+    this->files.clear();
+    this->postings.clear();
+    this->count = 0;
+}
+
+size_t ReferenceIndex::memoryUsage() const
+{
+    size_t bytes = this->files.capacity() * sizeof(File);
+    for (auto &file : this->files)
+    {
+        bytes += file.entries.capacity() * sizeof(Entry) + file.posted.capacity() * sizeof(SymbolId);
+    }
+    // Buckets plus one hash node per segment.
+    bytes += this->postings.bucket_count() * sizeof(void *);
+    for (auto &entry : this->postings)
+    {
+        bytes += sizeof(entry) + sizeof(void *) + entry.second.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
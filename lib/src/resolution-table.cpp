@@ -0,0 +1,64 @@
+#include <resolution-table.h>
+#include <algorithm>
+
+using stack_graph::NodeRef;
+using stack_graph::ResolutionTable;
+using stack_graph::ResolveStatus;
+
+const char *stack_graph::resolveStatusName(ResolveStatus status)
+{
+    switch (status)
+    {
+    case RESOLVE_OK:
+        return "ok";
+    case RESOLVE_NOT_FOUND:
+        return "not_found";
+    case RESOLVE_BUDGET_EXCEEDED:
+        return "budget_exceeded";
+    case RESOLVE_CYCLE:
+        return "cycle";
+    }
+    return "unknown";
+}
+
+NodeRef ResolutionTable::find(uint32_t file, NodeId node, ResolveStatus &status) const
+{
+    status = stack_graph::RESOLVE_NOT_FOUND;
+    if (file >= this->files.size())
+    {
+        return NodeRef();
+    }
+
+    auto &entries = this->files[file].entries;
+    auto it = std::lower_bound(entries.begin(), entries.end(), node, [](const Entry &e, NodeId id)
+                               { return e.node < id; });
+    if (it == entries.end() || it->node != node)
+    {
+        return NodeRef();
+    }
+    if (it->file == stack_graph::NO_FILE)
+    {
+        status = (ResolveStatus)it->definition;
+        return NodeRef();
+    }
+    status = stack_graph::RESOLVE_OK;
+    return NodeRef(this->files[it->file].tree, it->definition);
+}
+
+void ResolutionTable::clear()
+{
+    this->files.clear();
+    this->built = false;
+    this->references = 0;
+    this->resolved = 0;
+}
+
+size_t ResolutionTable::memoryUsage() const
+{
+    size_t bytes = this->files.capacity() * sizeof(File);
+    for (auto &file : this->files)
+    {
+        bytes += file.entries.capacity() * sizeof(Entry);
+    }
+    return bytes;
+}
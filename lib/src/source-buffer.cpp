@@ -0,0 +1,116 @@
+#include <source-buffer.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+using stack_graph::SourceBuffer;
+using stack_graph::SourceStamp;
+
+SourceStamp _stamp_of(const struct stat &st)
+{
+    return {(uint64_t)st.st_size, (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec, 0};
+}
+
+uint64_t stack_graph::hashBytes(const char *data, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++)
+    {
+        h = (h ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+bool stack_graph::statSource(const string &path, SourceStamp &stamp)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    stamp = _stamp_of(st);
+    return true;
+}
+
+SourceBuffer::SourceBuffer(const string &path)
+{
+    this->data = "";
+    this->size = 0;
+    this->mapped = false;
+    this->stamp = {0, 0, 0};
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat st;
+    bool has_stat = fstat(fd, &st) == 0;
+    if (has_stat)
+    {
+        this->stamp = _stamp_of(st);
+    }
+    if (has_stat && S_ISREG(st.st_mode) && (size_t)st.st_size >= stack_graph::SOURCE_MAP_THRESHOLD)
+    {
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+            this->data = static_cast<const char *>(addr);
+            this->size = st.st_size;
+            this->mapped = true;
+            close(fd);
+            return;
+        }
+    }
+
+    // Small files, pipes, procfs entries and anything else mmap refuses are
+    // read whole, straight into the buffer; a file that shrinks meanwhile
+    // just reads short.
+    size_t length = 0;
+    size_t expected = has_stat && S_ISREG(st.st_mode) ? st.st_size + 1 : 0;
+    this->fallback.resize(std::max<size_t>(expected, 4096));
+    while (true)
+    {
+        if (length == this->fallback.size())
+        {
+            this->fallback.resize(length * 2);
+        }
+        ssize_t n = read(fd, &this->fallback[length], this->fallback.size() - length);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        length += n;
+    }
+    this->fallback.resize(length);
+    close(fd);
+
+    this->data = this->fallback.data();
+    this->size = this->fallback.size();
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    if (this->mapped)
+    {
+        munmap(const_cast<char *>(this->data), this->size);
+    }
+}
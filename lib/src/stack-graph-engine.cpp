@@ -1,7 +1,6 @@
 
 
 #include <stack-graph-engine.h>
-#include <fstream>
 #include <tuple>
 #include <sstream>
 #include <iostream>
@@ -9,112 +8,181 @@
 #include <vector>
 #include <iostream>
 #include <filesystem>
-#include <re2/re2.h>
-
-namespace fs = std::filesystem;
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <condition_variable>
+#include <set>
+#include <iterator>
+#include <sys/stat.h>
 
 using stack_graph::build_stack_graph_tree;
 using stack_graph::Coordinate;
+using stack_graph::DiscoveredFile;
+using stack_graph::FileStream;
+using stack_graph::IndexScan;
+using stack_graph::PathFilter;
+using stack_graph::ResolveBudget;
+using stack_graph::ResolveStatus;
+using stack_graph::ScannedFile;
+using stack_graph::SourceStamp;
 using stack_graph::Point;
+using stack_graph::SourceBuffer;
 using stack_graph::StackGraphEngine;
+using stack_graph::NodeId;
+using stack_graph::NodeRef;
 using stack_graph::StackGraphNode;
 using stack_graph::StackGraphNodeKind;
+using stack_graph::StackGraphTree;
+using stack_graph::StringInterner;
+using stack_graph::SymbolId;
+using stack_graph::SymbolMap;
 
 extern "C" TSLanguage *tree_sitter_c();
 
-void _index(string &path, shared_ptr<StackGraphNode> node, unordered_map<Coordinate, shared_ptr<StackGraphNode>> &map)
+TSParser *stack_graph::ParserPool::acquire()
 {
-    Coordinate coord(path, node->location.line, node->location.column);
-    map[coord] = node;
-    for (auto ch : node->children)
     {
-        _index(path, ch, map);
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->idle.empty())
+        {
+            auto parser = this->idle.back();
+            this->idle.pop_back();
+            return parser;
+        }
     }
+
+    TSParser *parser = ts_parser_new();
+    ts_parser_set_language(parser, tree_sitter_c());
+    this->created++;
+    return parser;
 }
 
-bool StackGraphEngine::loadFile(string path)
+void stack_graph::ParserPool::release(TSParser *parser)
 {
-    std::ifstream file_stream(path);
-    std::stringstream buffer;
-    buffer << file_stream.rdbuf();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->idle.push_back(parser);
+}
 
-    auto contents = buffer.str();
-    auto source_code = contents.c_str();
+stack_graph::ParserPool::~ParserPool()
+{
+    for (auto parser : this->idle)
+    {
+        ts_parser_delete(parser);
+    }
+}
 
-    file_stream.close();
+shared_ptr<StackGraphTree> StackGraphEngine::parseFile(string path)
+{
+    SourceBuffer source(path);
+    return this->_parseSource(path, source);
+}
 
-    // Create a parser.
-    TSParser *parser = ts_parser_new();
+shared_ptr<StackGraphTree> StackGraphEngine::_parseSource(const string &path, SourceBuffer &source)
+{
+    this->bytes_read += source.size;
+    this->bytes_copied += source.bytesCopied();
 
-    // Set the parser's language (JSON in this case).
-    ts_parser_set_language(parser, tree_sitter_c());
+    TSParser *parser = this->parsers.acquire();
 
     TSTree *tree = ts_parser_parse_string(
         parser,
         NULL,
-        source_code,
-        strlen(source_code));
+        source.data,
+        source.size);
+
+    this->parsers.release(parser);
 
     TSNode root_node = ts_tree_root_node(tree);
 
-    auto sg_tree = build_stack_graph_tree(root_node, source_code);
-    bool ret = false;
+    auto sg_tree = build_stack_graph_tree(root_node, source.view(), this->symbols, this->builder);
     if (sg_tree != nullptr)
     {
-        sg_tree->symbol = path;
-        // std::cout << sg_tree->repr() << std::endl;
-
-        this->translation_units[path] = sg_tree;
-        _index(path, sg_tree, this->node_table);
-        ret = true;
-    }
-    else {
-        // std::cout << "Error parsing source file" << std::endl;
+        sg_tree->root()->symbol = this->symbols.intern(path);
+        sg_tree->source = source.stamp;
+        sg_tree->source.hash = stack_graph::hashBytes(source.data, source.size);
     }
 
     ts_tree_delete(tree);
-    return ret;
+    return sg_tree;
 }
 
-string _pop_stack(string &stack)
+void StackGraphEngine::addTranslationUnit(string path, shared_ptr<StackGraphTree> sg_tree)
 {
-    size_t pos_end = stack.find(".");
-    if (pos_end == string::npos)
-    {
-        string prev = stack;
-        stack = "";
-        return prev;
-    }
-    else
+    if (this->translation_units.find(path) != this->translation_units.end())
     {
-        string ret = stack.substr(0, pos_end);
-        stack = stack.substr(pos_end + 1, string::npos);
-        return ret;
+        this->_retireUnits({path});
     }
+    this->translation_units[path] = sg_tree;
+    auto file = this->node_table.insert(path, *sg_tree);
+    this->includes.insert(file, *sg_tree);
+    this->usages.insert(*sg_tree);
+    this->references.insert(file, *sg_tree);
+    this->generation++;
 }
 
-bool _contains_segment(string stack, string segment)
+unordered_set<string> StackGraphEngine::_retireUnits(const vector<string> &paths)
 {
-    size_t pos_begin = 0, pos_end;
-    while (true)
+    unordered_set<StackGraphTree *> retiring;
+    for (auto &path : paths)
     {
-        pos_end = stack.find(".", pos_begin);
-        string seg = stack.substr(pos_begin, pos_end);
-
-        if (seg == segment)
+        auto found = this->translation_units.find(path);
+        if (found != this->translation_units.end())
         {
-            return true;
+            retiring.insert(found->second.get());
         }
+    }
 
-        if (pos_end == string::npos)
+    // One pass over the links: links out of a retiring unit go with it, links
+    // into one are undone so the symbol no longer points at freed nodes.
+    unordered_set<string> unlinked;
+    size_t kept = 0;
+    for (auto &link : this->cross_links)
+    {
+        if (retiring.count(link.symbol.tree))
         {
-            return false;
+            continue;
         }
-        else
+        if (retiring.count(link.definition.tree))
+        {
+            this->usages.jump(link.symbol, link.previous);
+            unlinked.insert(string(link.symbol.root().symbolText()));
+            continue;
+        }
+        this->cross_links[kept++] = link;
+    }
+    this->cross_links.resize(kept, CrossLink(NodeRef(), NodeRef()));
+
+    for (auto &path : paths)
+    {
+        auto found = this->translation_units.find(path);
+        if (found == this->translation_units.end())
         {
-            pos_begin = pos_end + 1;
+            continue;
         }
+        this->references.erase(this->node_table.fileOf(found->second.get()));
+        this->node_table.erase(path);
+        this->usages.erase(*found->second);
+        this->translation_units.erase(found);
+        this->generation++;
+    }
+
+    return unlinked;
+}
+
+bool StackGraphEngine::loadFile(string path)
+{
+    auto sg_tree = this->parseFile(path);
+    if (sg_tree == nullptr)
+    {
+        // std::cout << "Error parsing source file" << std::endl;
+        return false;
     }
+
+    this->addTranslationUnit(path, sg_tree);
+    return true;
 }
 
 void _push_stack(string &stack, string val)
@@ -122,100 +190,219 @@ void _push_stack(string &stack, string val)
     stack = val + "." + stack;
 }
 
-shared_ptr<StackGraphNode> _find_in_parents(shared_ptr<StackGraphNode> node, string elem)
+NodeRef _find_in_children(NodeRef node, SymbolId elem)
+{
+    auto child = node.tree->findChild(node.id, elem);
+    return child == stack_graph::NO_NODE ? NodeRef() : NodeRef(node.tree, child);
+}
+
+NodeRef _find_in_parents(NodeRef node, SymbolId elem)
 {
-    shared_ptr<StackGraphNode> it = node;
+    NodeRef it = node;
     while (it != nullptr)
     {
-        for (auto ch : it->children)
+        auto found = _find_in_children(it, elem);
+        if (found != nullptr)
         {
-            if (ch->symbol == elem)
-            {
-                return ch;
-            }
+            return found;
         }
-        it = it->parent;
+        it = it.parent();
     }
     return nullptr;
 }
 
-shared_ptr<StackGraphNode> _find_in_children(shared_ptr<StackGraphNode> node, string elem)
+// Steps between two looks at the clock.
+const size_t _CLOCK_STEPS = 64;
+
+// The segment ids of a dotted reference, split off one at a time so a walk
+// that gives up early never reads the rest. Segments that were never
+// interned come back as NO_SYMBOL, which matches no node. A trailing empty
+// segment is dropped, as popping "a." leaves nothing to resolve.
+struct _Segments
 {
-    for (auto ch : node->children)
+    StringInterner &symbols;
+    std::string_view text;
+    size_t pos = 0;
+
+    bool done() const
+    {
+        return pos >= text.size();
+    }
+
+    SymbolId take()
     {
-        if (ch->symbol == elem)
+        auto end = text.find('.', pos);
+        if (end == std::string_view::npos)
         {
-            return ch;
+            end = text.size();
         }
+        auto segment = symbols.find(text.substr(pos, end - pos));
+        pos = end + 1;
+        return segment;
     }
-    return nullptr;
-}
+};
 
-shared_ptr<Coordinate> StackGraphEngine::resolve(Coordinate coord)
+// The symbols a walk passed since its last segment. Chains of links are
+// short, so the first few are kept without allocating.
+struct _Jumped
 {
-    auto search = this->node_table.find(coord);
-    if (search == this->node_table.end())
+    NodeRef first[8];
+    size_t size = 0;
+    vector<NodeRef> rest;
+
+    // Adds `node`; false when it was there already.
+    bool insert(NodeRef node)
     {
-        // std::cout << "resolve: not found" << std::endl;
-        return nullptr;
+        for (size_t i = 0; i < std::min<size_t>(size, 8); i++)
+        {
+            if (first[i] == node)
+            {
+                return false;
+            }
+        }
+        if (size >= 8 && std::find(rest.begin(), rest.end(), node) != rest.end())
+        {
+            return false;
+        }
+        if (size < 8)
+        {
+            first[size] = node;
+        }
+        else
+        {
+            rest.push_back(node);
+        }
+        size++;
+        return true;
     }
 
-    auto value = search->second;
-
-    if (value->kind == StackGraphNodeKind::NAMED_SCOPE)
+    void clear()
     {
-        return nullptr;
+        size = 0;
+        rest.clear();
     }
+};
+
+// Walks the segments of `value` to the node they name. Each step takes the
+// next segment from a reference or named scope, or follows the link of a
+// symbol; any other node ends the walk. The symbols passed since the last
+// segment are kept, as only links can lead back to a node visited before.
+// `steps` counts the steps taken, never more than the budget allows.
+NodeRef _resolve_node(StringInterner &symbols, NodeRef value, const stack_graph::ResolveBudget &budget, stack_graph::ResolveStatus &status, size_t &steps)
+{
+    _Segments segments{symbols, value.symbolText()};
 
-    string stack = value->symbol;
-
-    // std::cout << "Looking up reference" << std::endl;
-    // std::cout << "Stack: " << stack << std::endl;
-
-    shared_ptr<StackGraphNode> current = value;
-
-    string elem;
+    NodeRef current = value;
+    _Jumped jumped;
+    steps = 0;
+    std::chrono::steady_clock::time_point deadline;
 
-    while (stack != "")
+    while (!segments.done())
     {
-        if (current->kind == StackGraphNodeKind::REFERENCE)
+        if (steps == budget.steps)
         {
-            elem = _pop_stack(stack);
-            auto next_val = _find_in_parents(current, elem);
-            if (next_val == nullptr)
-                break;
-            current = next_val;
+            status = stack_graph::RESOLVE_BUDGET_EXCEEDED;
+            return NodeRef();
         }
-        else if (current->kind == StackGraphNodeKind::SYMBOL)
+        if (++steps % _CLOCK_STEPS == 0)
         {
-            auto next_val = current->jump_to;
-            if (current->jump_to == nullptr)
+            // Short walks never read the clock; long ones are timed from
+            // their first check.
+            auto now = std::chrono::steady_clock::now();
+            if (steps == _CLOCK_STEPS)
             {
-                break;
+                deadline = now + std::chrono::microseconds(budget.time_us);
+            }
+            if (now > deadline)
+            {
+                status = stack_graph::RESOLVE_BUDGET_EXCEEDED;
+                return NodeRef();
             }
-            current = next_val;
-            // std::cout << "Node Jump" << std::endl;
         }
-        else if (current->kind == StackGraphNodeKind::NAMED_SCOPE)
+
+        NodeRef next_val;
+        switch (current->kind)
         {
-            elem = _pop_stack(stack);
-            auto next_val = _find_in_children(current, elem);
-            if (next_val == nullptr)
-                break;
-            current = next_val;
+        case StackGraphNodeKind::REFERENCE:
+            next_val = _find_in_parents(current, segments.take());
+            jumped.clear();
+            break;
+        case StackGraphNodeKind::NAMED_SCOPE:
+            next_val = _find_in_children(current, segments.take());
+            jumped.clear();
+            break;
+        case StackGraphNodeKind::SYMBOL:
+            if (!jumped.insert(current))
+            {
+                status = stack_graph::RESOLVE_CYCLE;
+                return NodeRef();
+            }
+            next_val = current->jump_to;
+            break;
+        default:
+            // Nothing to follow from imports and unnamed scopes.
+            break;
+        }
+
+        if (next_val == nullptr)
+        {
+            // A miss on the last segment keeps the node reached so far: a
+            // symbol resolves to the scope it jumps to, whose children do
+            // not repeat its name.
+            bool last = segments.done();
+            status = last ? stack_graph::RESOLVE_OK : stack_graph::RESOLVE_NOT_FOUND;
+            return last ? current : NodeRef();
         }
+        current = next_val;
+    }
+
+    status = stack_graph::RESOLVE_OK;
+    return current;
+}
+
+shared_ptr<Coordinate> StackGraphEngine::resolve(Coordinate coord)
+{
+    ResolveStatus status;
+    return this->resolve(coord, this->resolve_budget, status);
+}
 
-        // std::cout << "Stack: " << stack << std::endl;
+shared_ptr<Coordinate> StackGraphEngine::resolve(Coordinate coord, const ResolveBudget &budget, ResolveStatus &status, size_t *steps)
+{
+    size_t taken = 0;
+    if (steps != nullptr)
+    {
+        *steps = 0;
+    }
+    status = stack_graph::RESOLVE_NOT_FOUND;
+    auto value = this->node_table.find(coord.path, coord.line, coord.column);
+    if (value == nullptr)
+    {
+        // std::cout << "resolve: not found" << std::endl;
+        return nullptr;
+    }
+
+    if (value->kind == StackGraphNodeKind::NAMED_SCOPE)
+    {
+        return nullptr;
     }
 
-    if (stack == "")
+    NodeRef current;
+    if (this->_resolutionsValid() && (value->kind == StackGraphNodeKind::REFERENCE || value->kind == StackGraphNodeKind::SYMBOL))
+    {
+        current = this->resolutions.find(this->node_table.fileOf(value.tree), value.id, status);
+    }
+    else
     {
-        auto it = current;
-        while (it->parent != nullptr)
-            it = it->parent;
+        current = _resolve_node(this->symbols, value, budget, status, taken);
+        if (steps != nullptr)
+        {
+            *steps = taken;
+        }
+    }
 
-        auto res = new Coordinate(it->symbol, current->location.line, current->location.column);
-        return shared_ptr<Coordinate>(res);
+    if (current != nullptr)
+    {
+        return std::make_shared<Coordinate>(string(current.root().symbolText()), current->location.line, current->location.column);
     }
     else
     {
@@ -223,282 +410,1381 @@ shared_ptr<Coordinate> StackGraphEngine::resolve(Coordinate coord)
     }
 }
 
-void StackGraphEngine::loadDirectoryRecursive(string path, std::vector<string> excludes)
+bool StackGraphEngine::_resolutionsValid() const
+{
+    return this->resolutions.built && this->resolutions.generation == this->generation && this->resolutions.jumps == this->usages.jumps;
+}
+
+void StackGraphEngine::resolveAll(unsigned int threads)
 {
-    std::regex regex("[a-z0-9\\-_]*\\.(c|h)");
-    for (const auto &entry : fs::recursive_directory_iterator(path))
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    this->resolutions.clear();
+    vector<uint32_t> files;
+    for (auto &entry : this->translation_units)
     {
-        if (!entry.is_directory())
+        auto id = this->node_table.file_ids.at(entry.first);
+        if (id >= this->resolutions.files.size())
         {
-            auto path = entry.path();
-            auto file = path.filename().string();
+            this->resolutions.files.resize(id + 1);
+        }
+        this->resolutions.files[id].tree = entry.second.get();
+        files.push_back(id);
+    }
 
-            if (std::any_of(excludes.begin(), excludes.end(), [&](string r)
-                            { return RE2::PartialMatch(path.string(), r); }))
+    // Each file's entries are written by the one thread that takes it.
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> references{0};
+    std::atomic<size_t> resolved{0};
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < files.size(); i = next++)
+        {
+            auto &file = this->resolutions.files[files[i]];
+            auto &tree = *file.tree;
+            size_t tried = 0;
+            size_t found = 0;
+            for (NodeId id = 0; id < tree.nodes.size(); id++)
             {
-                continue;
-            }
+                auto kind = tree.nodes[id].kind;
+                if (kind != StackGraphNodeKind::REFERENCE && kind != StackGraphNodeKind::SYMBOL)
+                {
+                    continue;
+                }
+                tried++;
 
-            if (std::regex_match(file, regex))
-            {
-                // std::cout << path.string() << std::endl;
-                if (this->loadFile(path))
+                ResolveStatus status;
+                size_t steps;
+                auto def = _resolve_node(this->symbols, NodeRef(&tree, id), this->resolve_budget, status, steps);
+                auto def_file = def == nullptr ? stack_graph::NO_FILE : this->node_table.fileOf(def.tree);
+                if (def_file != stack_graph::NO_FILE)
+                {
+                    file.entries.push_back({id, def_file, def.id});
+                    found++;
+                }
+                else if (status != stack_graph::RESOLVE_OK && status != stack_graph::RESOLVE_NOT_FOUND)
                 {
-                    this->name_to_path.insert({file, path.string()});
+                    file.entries.push_back({id, stack_graph::NO_FILE, (NodeId)status});
                 }
             }
+            file.entries.shrink_to_fit();
+            references += tried;
+            resolved += found;
         }
-    }
-}
+    };
 
-void _walk_tree(shared_ptr<StackGraphNode> node, std::function<bool(shared_ptr<StackGraphNode>)> pred, std::function<void(shared_ptr<StackGraphNode>)> cbk)
-{
-    if (pred(node))
+    vector<std::thread> workers;
+    for (unsigned int t = 1; t < threads; t++)
     {
-        cbk(node);
+        workers.emplace_back(worker);
     }
-    for (auto ch : node->children)
+    worker();
+    for (auto &w : workers)
     {
-        _walk_tree(ch, pred, cbk);
+        w.join();
     }
+
+    this->resolutions.references = references;
+    this->resolutions.resolved = resolved;
+    this->resolutions.generation = this->generation;
+    this->resolutions.jumps = this->usages.jumps;
+    this->resolutions.built = true;
 }
 
-vector<string> StackGraphEngine::importsForTranslationUnit(string path)
+// Keeps paths with the same file name in path order, as resolveImport takes
+// the first match and a fresh index inserts in path order.
+void _insert_name(std::multimap<string, string> &name_to_path, const string &path)
 {
-    vector<string> lst;
-
-    try
+    auto name = fs::path(path).filename().string();
+    auto range = name_to_path.equal_range(name);
+    auto it = range.first;
+    while (it != range.second && it->second < path)
     {
-        auto root = this->translation_units.at(path);
-        _walk_tree(
-            root,
-            [](shared_ptr<StackGraphNode> node)
-            { return node->kind == StackGraphNodeKind::IMPORT; },
-            [&](shared_ptr<StackGraphNode> node)
-            { lst.push_back(node->symbol); });
+        ++it;
     }
-    catch (std::out_of_range ex)
+    if (it == range.second || it->second != path)
     {
+        name_to_path.insert(it, {name, path});
     }
-
-    return lst;
 }
 
-vector<shared_ptr<StackGraphNode>> StackGraphEngine::exportedDefinitionsForTranslationUnit(string path)
+void StackGraphEngine::_scanFile(DiscoveredFile file, vector<ScannedFile> &out)
 {
-    vector<shared_ptr<StackGraphNode>> lst;
-
-    auto itr = this->translation_units.find(path);
-    if (itr == this->translation_units.end())
+    if (this->documents.find(file.path) != this->documents.end())
     {
-        return lst;
+        return;
     }
 
-    auto val = itr->second;
+    auto found = this->translation_units.find(file.path);
+    StackGraphTree *old = found == this->translation_units.end() ? nullptr : found->second.get();
 
-    for (auto ch : val->children)
+    SourceStamp stamp;
+    if (old != nullptr && stack_graph::statSource(file.path, stamp) && old->source.sameMetadata(stamp))
     {
-        if (ch->kind == StackGraphNodeKind::NAMED_SCOPE)
+        out.push_back({std::move(file), nullptr, old->source});
+        return;
+    }
+
+    SourceBuffer source(file.path);
+    if (old != nullptr)
+    {
+        // Touched but not edited: keep the tree, take the new mtime.
+        source.stamp.hash = stack_graph::hashBytes(source.data, source.size);
+        if (old->source.sameContent(source.stamp))
         {
-            lst.push_back(ch);
+            out.push_back({std::move(file), nullptr, source.stamp});
+            return;
         }
     }
 
-    return lst;
+    auto sg_tree = this->_parseSource(file.path, source);
+    if (sg_tree != nullptr)
+    {
+        stamp = sg_tree->source;
+        out.push_back({std::move(file), sg_tree, stamp});
+    }
 }
 
-vector<shared_ptr<StackGraphNode>> StackGraphEngine::symbolsForTranslationUnit(string path)
+void StackGraphEngine::_scanFiles(FileStream &stream, unsigned int threads, vector<ScannedFile> &out)
 {
-    vector<shared_ptr<StackGraphNode>> lst;
+    vector<vector<ScannedFile>> loaded(threads);
+    auto worker = [&](vector<ScannedFile> &files)
+    {
+        DiscoveredFile file;
+        while (stream.pop(file))
+        {
+            this->_scanFile(std::move(file), files);
+        }
+    };
 
-    auto itr = this->translation_units.find(path);
-    if (itr == this->translation_units.end())
+    vector<std::thread> workers;
+    for (unsigned int t = 1; t < threads; t++)
     {
-        return lst;
+        workers.emplace_back(worker, std::ref(loaded[t]));
     }
+    worker(loaded[0]);
 
-    _walk_tree(
-        itr->second,
-        [](shared_ptr<StackGraphNode> node)
-        { return node->kind == StackGraphNodeKind::SYMBOL; },
-        [&](shared_ptr<StackGraphNode> node)
-        { lst.push_back(node); });
+    for (auto &w : workers)
+    {
+        w.join();
+    }
 
-    return lst;
+    for (auto &lst : loaded)
+    {
+        std::move(lst.begin(), lst.end(), std::back_inserter(out));
+    }
 }
 
-string StackGraphEngine::resolveImport(string import)
+void StackGraphEngine::_scanDirectory(const string &path, const PathFilter &filter, unsigned int threads, bool follow_symlinks, vector<ScannedFile> &out)
 {
-    auto file = fs::path(import).filename().string();
+    FileStream stream;
+    std::thread discovery([&]()
+                          { stack_graph::discoverSourceFiles(path, filter, threads, follow_symlinks, stream); });
 
-    const auto found = this->name_to_path.equal_range(file);
+    this->_scanFiles(stream, threads, out);
+    discovery.join();
+}
 
-    for (auto i = found.first; i != found.second; ++i)
+stack_graph::IndexScan StackGraphEngine::scanPaths(const vector<string> &paths, const PathFilter &filter, unsigned int threads, bool follow_symlinks)
+{
+    if (threads == 0)
     {
-        if (i->second.find(import) != string::npos)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    IndexScan scan;
+    for (auto &path : paths)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
         {
-            return i->second;
+            // Gone: drop it, or everything below it if it was a directory.
+            scan.roots.push_back(path);
+            scan.removed.push_back(path);
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            scan.roots.push_back(path);
+            this->_scanDirectory(path, filter, threads, follow_symlinks, scan.files);
+        }
+        else if (S_ISREG(st.st_mode) && stack_graph::isSourceFileName(fs::path(path).filename().string()) && !filter.isExcluded(path))
+        {
+            this->_scanFile({path, st.st_dev, st.st_ino}, scan.files);
+        }
+        else
+        {
+            scan.removed.push_back(path);
         }
     }
-
-    return "";
+    return scan;
 }
 
-void StackGraphEngine::_visitUnitsInTopologicalOrder(
-    unordered_map<string, unordered_map<string, shared_ptr<StackGraphNode>>> &cache,
-    unordered_set<string> &visited,
-    unordered_map<string, string> &h_to_c,
-    string unit)
+stack_graph::IndexDelta StackGraphEngine::applyScan(IndexScan &scan)
 {
+    auto &files = scan.files;
 
-    if (visited.find(unit) != visited.end())
-    {
-        return;
-    }
-    visited.insert(unit);
-
-    // std::cout << unit << std::endl;
-
-    unordered_map<string, shared_ptr<StackGraphNode>> transitive_defs;
+    // Merge in path order and keep only the first path of a hard or symbolic
+    // link, so the tables do not depend on crawl order or thread scheduling.
+    std::sort(files.begin(), files.end(), [](const ScannedFile &a, const ScannedFile &b)
+              { return a.file.path < b.file.path; });
 
-    for (auto import : this->importsForTranslationUnit(unit))
+    std::set<std::pair<dev_t, ino_t>> seen;
+    unordered_set<string> scanned;
+    vector<ScannedFile *> kept;
+    for (auto &f : files)
     {
-        auto path_import = this->resolveImport(import);
-
-        if (path_import != "")
+        if (!seen.insert({f.file.device, f.file.inode}).second || this->documents.count(f.file.path))
         {
-
-            if (cache.find(path_import) == cache.end() && visited.find(path_import) == visited.end())
-            {
-
-                this->_visitUnitsInTopologicalOrder(cache, visited, h_to_c, path_import);
-            }
-
-            if (cache.find(path_import) != cache.end())
-            {
-                auto defs = cache.find(path_import)->second;
-                for (auto &entry : defs)
-                {
-                    transitive_defs.insert(entry);
-                }
-            }
+            continue;
         }
+        scanned.insert(f.file.path);
+        kept.push_back(&f);
     }
 
-    for (auto &def : this->exportedDefinitionsForTranslationUnit(unit))
+    // Units under a scanned root that were not found again are gone (or now
+    // excluded); units loaded from elsewhere are left alone.
+    IndexDelta delta;
+    unordered_set<string> removed(scan.removed.begin(), scan.removed.end());
+    for (auto &entry : this->translation_units)
     {
-        transitive_defs.insert({def->symbol, def});
+        if (scanned.find(entry.first) != scanned.end() || this->documents.count(entry.first))
+        {
+            continue;
+        }
+        bool gone = removed.find(entry.first) != removed.end();
+        for (size_t r = 0; !gone && r < scan.roots.size(); r++)
+        {
+            auto &root = scan.roots[r];
+            auto size = root.back() == '/' ? root.size() : root.size() + 1;
+            gone = entry.first.size() > size && entry.first.compare(0, root.size(), root) == 0 && entry.first[size - 1] == '/';
+        }
+        if (gone)
+        {
+            delta.removed_paths.push_back(entry.first);
+        }
     }
+    std::sort(delta.removed_paths.begin(), delta.removed_paths.end());
+    vector<string> retiring = delta.removed_paths;
 
-    if (h_to_c.find(unit) != h_to_c.end())
+    unordered_set<string> replaced;
+    for (auto f : kept)
     {
-        auto c_file = h_to_c.find(unit)->second;
-
-        for (auto &def : this->exportedDefinitionsForTranslationUnit(c_file))
+        if (f->sg_tree != nullptr && this->translation_units.find(f->file.path) != this->translation_units.end())
         {
-            transitive_defs.insert({def->symbol, def});
+            retiring.push_back(f->file.path);
+            replaced.insert(f->file.path);
         }
     }
 
-    // now all the transitive definitions are loaded
+    for (auto &unit : this->_retireUnits(retiring))
+    {
+        delta.unlinked.push_back(unit);
+    }
+    std::sort(delta.unlinked.begin(), delta.unlinked.end());
 
-    for (auto &sym : this->symbolsForTranslationUnit(unit))
+    for (auto f : kept)
     {
-        if (transitive_defs.find(sym->symbol) != transitive_defs.end())
+        if (f->sg_tree == nullptr)
         {
-            auto def = transitive_defs.find(sym->symbol)->second;
-            sym->jump_to = def;
-            this->cross_links.push_back(CrossLink(sym, def));
+            auto found = this->translation_units.find(f->file.path);
+            if (found != this->translation_units.end())
+            {
+                found->second->source = f->stamp;
+                delta.skipped++;
+            }
+            continue;
         }
-    }
-
-    cache.insert({unit, transitive_defs});
-}
-
-void StackGraphEngine::crossLink()
-{
 
-    this->h_to_c.clear();
+        if (replaced.count(f->file.path))
+        {
+            delta.reparsed++;
+        }
+        else
+        {
+            delta.added++;
+            _insert_name(this->name_to_path, f->file.path);
+        }
+        this->addTranslationUnit(f->file.path, f->sg_tree);
+        delta.changed.push_back(f->file.path);
+    }
 
-    for (auto &entry : this->translation_units)
+    for (auto &path : delta.removed_paths)
     {
-        auto k = entry.first;
-        auto v = entry.second;
-
-        if (RE2::FullMatch(fs::path(k).filename().string(), "[a-z0-9\\-_]*\\.c"))
+        this->includes.erase(this->node_table.file_ids.at(path));
+        auto range = this->name_to_path.equal_range(fs::path(path).filename().string());
+        for (auto it = range.first; it != range.second; ++it)
         {
-            for (auto &import : this->importsForTranslationUnit(k))
+            if (it->second == path)
             {
-                auto abs_import = this->resolveImport(import);
-
-                if (RE2::FullMatch(import, "[a-z0-9\\-_]*\\.h") && abs_import != "")
-                {
-                    this->h_to_c[abs_import] = k;
-                    // std::cout << k << std::endl;
-                }
+                this->name_to_path.erase(it);
+                break;
             }
         }
     }
+    delta.removed = delta.removed_paths.size();
 
-    unordered_map<string, unordered_map<string, shared_ptr<StackGraphNode>>> cache;
-    unordered_set<string> visited;
-    this->cross_links.clear();
+    return delta;
+}
 
-    for (auto &entry : this->translation_units)
+vector<SymbolId> _import_symbols(StackGraphTree &tree)
+{
+    vector<SymbolId> imports;
+    for (auto &node : tree.nodes)
     {
-        _visitUnitsInTopologicalOrder(cache, visited, h_to_c, entry.first);
+        if (node.kind == StackGraphNodeKind::IMPORT)
+        {
+            imports.push_back(node.symbol);
+        }
     }
+    return imports;
 }
 
-vector<shared_ptr<Coordinate>> StackGraphEngine::findUsages(Coordinate coord)
+stack_graph::IndexScan StackGraphEngine::scanCompileCommands(const string &root, const PathFilter &filter, unsigned int threads)
 {
-    vector<shared_ptr<Coordinate>> lst;
-    auto search = this->node_table.find(coord);
-    if (search == this->node_table.end())
+    if (threads == 0)
     {
-        return lst;
+        threads = std::max(1u, std::thread::hardware_concurrency());
     }
 
-    auto value = search->second;
-
-    if (value->kind == StackGraphNodeKind::NAMED_SCOPE)
+    IndexScan scan;
+    auto base = fs::path(root).lexically_normal().string();
+    scan.roots.push_back(base);
+    if (base.back() != '/')
     {
-        for (auto &kv : this->node_table)
+        base += '/';
+    }
+
+    // Files under the root that the filter keeps, by path; a missing entry
+    // means the file is not indexed.
+    unordered_map<string, DiscoveredFile> files;
+    unordered_map<string, bool> checked;
+    auto indexable = [&](const string &path)
+    {
+        auto found = checked.find(path);
+        if (found != checked.end())
+        {
+            return found->second;
+        }
+
+        struct stat st;
+        bool ok = path.size() > base.size() && path.compare(0, base.size(), base) == 0 &&
+                  stack_graph::isSourceFileName(fs::path(path).filename().string()) && !filter.isExcluded(path) &&
+                  stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+        if (ok)
+        {
+            files[path] = {path, st.st_dev, st.st_ino};
+        }
+        checked[path] = ok;
+        return ok;
+    };
+
+    unordered_map<string, uint32_t> contexts;
+    vector<string> wave;
+    for (auto &source : this->compile_db.sources)
+    {
+        if (indexable(source) && contexts.insert({source, this->compile_db.contextOf(source)}).second)
+        {
+            wave.push_back(source);
+        }
+    }
+
+    // Each wave is read and parsed in parallel; the includes it resolves to
+    // files not seen yet make up the next one.
+    unordered_map<string, string> resolved;
+    while (!wave.empty())
+    {
+        FileStream stream;
+        for (auto &path : wave)
         {
-            auto v = kv.second;
-            if (v->kind == StackGraphNodeKind::SYMBOL && v->jump_to != nullptr && v->jump_to == value)
+            stream.push(files.at(path));
+        }
+        stream.close();
+
+        auto first = scan.files.size();
+        this->_scanFiles(stream, threads, scan.files);
+        std::sort(scan.files.begin() + first, scan.files.end(), [](const ScannedFile &a, const ScannedFile &b)
+                  { return a.file.path < b.file.path; });
+
+        wave.clear();
+        for (auto i = first; i < scan.files.size(); i++)
+        {
+            auto &path = scan.files[i].file.path;
+            auto context = contexts.at(path);
+            auto spellings = scan.files[i].sg_tree != nullptr ? _import_symbols(*scan.files[i].sg_tree) : this->includes.spellingsOf(this->node_table.file_ids.at(path));
+            for (auto spelling : spellings)
             {
+                auto text = string(this->symbols.text(spelling));
+                auto key = std::to_string(context) + '\0' + text;
+                auto found = resolved.find(key);
+                if (found == resolved.end())
+                {
+                    found = resolved.insert({key, this->compile_db.resolve(context, text, indexable)}).first;
+                }
 
-                auto it = v;
-                while (it->parent != nullptr)
+                auto &target = found->second;
+                if (target != "" && contexts.insert({target, this->compile_db.derive(context, target)}).second)
                 {
-                    it = it->parent;
+                    wave.push_back(target);
                 }
+            }
+        }
+    }
+    return scan;
+}
+
+stack_graph::IndexDelta StackGraphEngine::loadDirectoryRecursive(string path, std::vector<string> excludes, unsigned int threads, bool follow_symlinks)
+{
+    this->bytes_read = 0;
+    this->bytes_copied = 0;
+
+    PathFilter filter(excludes);
+    auto scan = this->compile_db.empty() ? this->scanPaths({path}, filter, threads, follow_symlinks) : this->scanCompileCommands(path, filter, threads);
+    return this->applyScan(scan);
+}
+
+// Byte offset and tree-sitter point of a position, clamped to the text.
+std::pair<uint32_t, TSPoint> _locate(const string &text, Point position)
+{
+    uint32_t offset = 0;
+    uint32_t row = 0;
+    while (row < position.line)
+    {
+        auto newline = text.find('\n', offset);
+        if (newline == string::npos)
+        {
+            break;
+        }
+        offset = newline + 1;
+        row++;
+    }
+
+    auto line_end = text.find('\n', offset);
+    if (line_end == string::npos)
+    {
+        line_end = text.size();
+    }
+    uint32_t column = std::min<uint32_t>(row == position.line ? position.column : UINT32_MAX, line_end - offset);
+    return {offset + column, {row, column}};
+}
+
+TSPoint _end_point(TSPoint start, const string &inserted)
+{
+    auto last_newline = inserted.rfind('\n');
+    if (last_newline == string::npos)
+    {
+        return {start.row, start.column + (uint32_t)inserted.size()};
+    }
+    return {start.row + (uint32_t)std::count(inserted.begin(), inserted.end(), '\n'), (uint32_t)(inserted.size() - last_newline - 1)};
+}
+
+bool StackGraphEngine::openDocument(const string &path, string text)
+{
+    auto existing = this->documents.find(path);
+    bool indexed = existing != this->documents.end() ? existing->second.indexed : this->translation_units.count(path) > 0;
+
+    TSParser *parser = this->parsers.acquire();
+    TSTree *tree = ts_parser_parse_string(parser, NULL, text.data(), text.size());
+    this->parsers.release(parser);
+
+    OpenDocument document{std::move(text), shared_ptr<TSTree>(tree, ts_tree_delete), indexed};
+    if (!this->_updateDocument(path, document))
+    {
+        return false;
+    }
+    this->documents[path] = std::move(document);
+    return true;
+}
+
+bool StackGraphEngine::changeDocument(const string &path, const vector<TextEdit> &edits)
+{
+    auto found = this->documents.find(path);
+    if (found == this->documents.end())
+    {
+        return false;
+    }
+
+    auto &document = found->second;
+    for (auto &edit : edits)
+    {
+        auto start = _locate(document.text, edit.start);
+        auto old_end = _locate(document.text, edit.end);
+        if (old_end.first < start.first)
+        {
+            old_end = start;
+        }
+
+        document.text.replace(start.first, old_end.first - start.first, edit.text);
+
+        TSInputEdit input;
+        input.start_byte = start.first;
+        input.old_end_byte = old_end.first;
+        input.new_end_byte = start.first + edit.text.size();
+        input.start_point = start.second;
+        input.old_end_point = old_end.second;
+        input.new_end_point = _end_point(start.second, edit.text);
+        ts_tree_edit(document.tree.get(), &input);
+    }
 
-                auto res = new Coordinate(it->symbol, v->location.line, v->location.column);
-                lst.push_back(shared_ptr<Coordinate>(res));
+    TSParser *parser = this->parsers.acquire();
+    TSTree *tree = ts_parser_parse_string(parser, document.tree.get(), document.text.data(), document.text.size());
+    this->parsers.release(parser);
+    document.tree = shared_ptr<TSTree>(tree, ts_tree_delete);
+
+    return this->_updateDocument(path, document);
+}
+
+bool StackGraphEngine::closeDocument(const string &path)
+{
+    auto found = this->documents.find(path);
+    if (found == this->documents.end())
+    {
+        return false;
+    }
+    bool indexed = found->second.indexed;
+    this->documents.erase(found);
+
+    IndexScan scan;
+    if (indexed)
+    {
+        scan = this->scanPaths({path}, PathFilter({}));
+    }
+    else
+    {
+        scan.removed.push_back(path);
+    }
+    this->crossLink(this->applyScan(scan));
+    return true;
+}
+
+vector<NodeRef> _exports(StackGraphTree &tree)
+{
+    vector<NodeRef> exports;
+    for (auto ch : tree.root().children())
+    {
+        if (ch->kind == StackGraphNodeKind::NAMED_SCOPE)
+        {
+            exports.push_back(ch);
+        }
+    }
+    return exports;
+}
+
+bool _same_symbols(const vector<NodeRef> &a, const vector<NodeRef> &b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](NodeRef x, NodeRef y)
+                      { return x->symbol == y->symbol; });
+}
+
+// Swaps in the stack graph of a document and relinks what it affects. The
+// stamp stays zero, so the file is read again once the document is closed.
+//
+// Most edits keep the imports and exported definitions of the unit. Then no
+// other unit can link differently: their links into the old tree are moved
+// to the matching definitions of the new one, and only the document's own
+// symbols are linked, against its cached imported definitions.
+bool StackGraphEngine::_updateDocument(const string &path, OpenDocument &document)
+{
+    auto sg_tree = build_stack_graph_tree(ts_tree_root_node(document.tree.get()), document.text, this->symbols, this->builder);
+    if (sg_tree == nullptr)
+    {
+        return false;
+    }
+    sg_tree->root()->symbol = this->symbols.intern(path);
+
+    auto found = this->translation_units.find(path);
+    auto old_exports = found == this->translation_units.end() ? vector<NodeRef>() : _exports(*found->second);
+    auto new_exports = _exports(*sg_tree);
+
+    if (found == this->translation_units.end() ||
+        this->includes.spellingsOf(this->node_table.fileOf(found->second.get())) != _import_symbols(*sg_tree) ||
+        !_same_symbols(old_exports, new_exports))
+    {
+        IndexDelta delta;
+        if (found != this->translation_units.end())
+        {
+            for (auto &unit : this->_retireUnits({path}))
+            {
+                delta.unlinked.push_back(unit);
             }
+            delta.reparsed = 1;
+        }
+        else
+        {
+            _insert_name(this->name_to_path, path);
+            delta.added = 1;
         }
+        this->addTranslationUnit(path, sg_tree);
+        delta.changed.push_back(path);
+
+        this->crossLink(delta);
+
+        unordered_map<string, SymbolMap> cache;
+        unordered_set<string> visited = {path};
+        document.imported = this->_importedDefinitions(cache, visited, this->h_to_c, path, {});
+        document.generation = this->generation;
+        return true;
     }
-    else if (value->kind == StackGraphNodeKind::SYMBOL)
+
+    auto old_tree = found->second;
+    unordered_map<NodeId, NodeRef> moved;
+    for (size_t i = 0; i < old_exports.size(); i++)
+    {
+        moved[old_exports[i].id] = new_exports[i];
+    }
+    auto remap = [&](NodeRef ref)
+    {
+        return ref.tree == old_tree.get() ? moved.at(ref.id) : ref;
+    };
+
+    size_t kept = 0;
+    for (auto &link : this->cross_links)
+    {
+        if (link.symbol.tree == old_tree.get())
+        {
+            continue;
+        }
+        if (link.definition.tree == old_tree.get())
+        {
+            link.definition = remap(link.definition);
+            this->usages.jump(link.symbol, link.definition);
+        }
+        this->cross_links[kept++] = link;
+    }
+    this->cross_links.resize(kept, CrossLink(NodeRef(), NodeRef()));
+
+    bool cached = document.generation == this->generation;
+
+    this->references.erase(this->node_table.fileOf(old_tree.get()));
+    this->node_table.erase(path);
+    this->usages.erase(*old_tree);
+    this->translation_units.erase(found);
+    this->addTranslationUnit(path, sg_tree);
+
+    if (cached)
+    {
+        vector<std::pair<SymbolId, NodeRef>> stale;
+        document.imported.forEach([&](SymbolId symbol, NodeRef def)
+                                  {
+            if (def.tree == old_tree.get())
+            {
+                stale.push_back({symbol, remap(def)});
+            } });
+        for (auto &entry : stale)
+        {
+            document.imported.assign(entry.first, entry.second);
+        }
+    }
+    else
+    {
+        unordered_map<string, SymbolMap> cache;
+        unordered_set<string> visited = {path};
+        document.imported = this->_importedDefinitions(cache, visited, this->h_to_c, path, {});
+    }
+    document.generation = this->generation;
+
+    auto defs = document.imported;
+    this->_addLocalDefinitions(path, defs);
+    this->_linkSymbols(path, defs);
+    return true;
+}
+
+void _walk_tree(StackGraphTree &tree, std::function<bool(NodeRef)> pred, std::function<void(NodeRef)> cbk)
+{
+    for (NodeId id = 0; id < tree.nodes.size(); id++)
+    {
+        NodeRef node(&tree, id);
+        if (pred(node))
+        {
+            cbk(node);
+        }
+    }
+}
+
+vector<string> StackGraphEngine::importsForTranslationUnit(string path)
+{
+    vector<string> lst;
+
+    auto file = this->node_table.file_ids.find(path);
+    if (file == this->node_table.file_ids.end())
+    {
+        return lst;
+    }
+    for (auto spelling : this->includes.spellingsOf(file->second))
+    {
+        lst.push_back(string(this->symbols.text(spelling)));
+    }
+
+    return lst;
+}
+
+vector<NodeRef> StackGraphEngine::exportedDefinitionsForTranslationUnit(string path)
+{
+    vector<NodeRef> lst;
+
+    auto itr = this->translation_units.find(path);
+    if (itr == this->translation_units.end())
+    {
+        return lst;
+    }
+
+    auto val = itr->second;
+
+    for (auto ch : val->root().children())
+    {
+        if (ch->kind == StackGraphNodeKind::NAMED_SCOPE)
+        {
+            lst.push_back(ch);
+        }
+    }
+
+    return lst;
+}
+
+vector<NodeRef> StackGraphEngine::symbolsForTranslationUnit(string path)
+{
+    vector<NodeRef> lst;
+
+    auto itr = this->translation_units.find(path);
+    if (itr == this->translation_units.end())
+    {
+        return lst;
+    }
+
+    _walk_tree(
+        *itr->second,
+        [](NodeRef node)
+        { return node->kind == StackGraphNodeKind::SYMBOL; },
+        [&](NodeRef node)
+        { lst.push_back(node); });
+
+    return lst;
+}
+
+string StackGraphEngine::resolveImport(string import)
+{
+    auto file = fs::path(import).filename().string();
+
+    const auto found = this->name_to_path.equal_range(file);
+
+    for (auto i = found.first; i != found.second; ++i)
+    {
+        if (i->second.find(import) != string::npos)
+        {
+            return i->second;
+        }
+    }
+
+    return "";
+}
+
+void StackGraphEngine::_updateIncludeGraph()
+{
+    vector<std::pair<uint32_t, uint32_t>> seeds;
+    for (auto &source : this->compile_db.sources)
+    {
+        auto file = this->node_table.file_ids.find(source);
+        if (file != this->node_table.file_ids.end() && this->translation_units.count(source))
+        {
+            seeds.push_back({file->second, this->compile_db.contextOf(source)});
+        }
+    }
+
+    auto resolve = [this](uint32_t context, SymbolId spelling)
+    {
+        string path;
+        if (context == stack_graph::NAME_CONTEXT)
+        {
+            path = this->resolveImport(string(this->symbols.text(spelling)));
+        }
+        else
+        {
+            path = this->compile_db.resolve(context, string(this->symbols.text(spelling)), [this](const string &candidate)
+                                            { return this->translation_units.count(candidate) > 0; });
+        }
+        auto file = this->node_table.file_ids.find(path);
+        return path == "" || file == this->node_table.file_ids.end() ? stack_graph::NO_FILE : file->second;
+    };
+
+    auto derive = [this](uint32_t context, uint32_t target)
+    { return this->compile_db.derive(context, this->node_table.files[target].path); };
+
+    this->includes.update(seeds, resolve, derive);
+}
+
+bool StackGraphEngine::useCompileCommands(const string &file)
+{
+    this->compile_db.clear();
+    this->includes.resolved.clear();
+    this->includes.stale = true;
+    return file == "" || this->compile_db.load(file);
+}
+
+shared_ptr<stack_graph::IncludeRelations> StackGraphEngine::includeRelations(const string &path)
+{
+    auto file = this->node_table.file_ids.find(path);
+    if (file == this->node_table.file_ids.end() || this->translation_units.find(path) == this->translation_units.end())
+    {
+        return nullptr;
+    }
+
+    auto paths = [this](const vector<uint32_t> &files)
+    {
+        vector<string> lst;
+        for (auto id : files)
+        {
+            lst.push_back(this->node_table.files[id].path);
+        }
+        return lst;
+    };
+
+    auto relations = std::make_shared<IncludeRelations>();
+    relations->includes = paths(this->includes.includesOf(file->second));
+    relations->transitive_includes = paths(this->includes.reachable(file->second, false));
+    relations->includers = paths(this->includes.files[file->second].includers);
+    relations->transitive_includers = paths(this->includes.reachable(file->second, true));
+    return relations;
+}
+
+void StackGraphEngine::_planLinks(LinkPlan &plan, uint32_t file)
+{
+    if (!plan.visited.insert(file).second)
+    {
+        return;
+    }
+
+    vector<uint32_t> deps;
+    for (auto target : this->includes.includesOf(file))
+    {
+        if (plan.index.find(target) == plan.index.end())
+        {
+            this->_planLinks(plan, target);
+        }
+
+        auto dep = plan.index.find(target);
+        if (dep != plan.index.end())
+        {
+            deps.push_back(dep->second);
+        }
+    }
+
+    plan.index[file] = plan.units.size();
+    plan.units.push_back(file);
+    plan.imports.push_back(std::move(deps));
+}
+
+void StackGraphEngine::_linkUnits(const LinkPlan &plan, const unordered_set<string> &relink, unsigned int threads)
+{
+    auto count = plan.units.size();
+    vector<SymbolMap> defs(count);
+    vector<vector<std::pair<NodeRef, NodeRef>>> links(count);
+
+    // Imports left before a unit is ready, and importers left before its
+    // definitions can go.
+    std::unique_ptr<std::atomic<uint32_t>[]> waiting(new std::atomic<uint32_t>[count]);
+    std::unique_ptr<std::atomic<uint32_t>[]> users(new std::atomic<uint32_t>[count]);
+    vector<vector<uint32_t>> importers(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        waiting[i] = plan.imports[i].size();
+        users[i] = 0;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        for (auto dep : plan.imports[i])
+        {
+            importers[dep].push_back(i);
+            users[dep]++;
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<uint32_t> ready;
+    size_t done = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (waiting[i] == 0)
+        {
+            ready.push_back(i);
+        }
+    }
+
+    auto link = [&](uint32_t i)
     {
-        for (auto &kv : this->node_table)
+        auto &unit = this->node_table.files[plan.units[i]].path;
+        for (auto dep : plan.imports[i])
+        {
+            defs[i].merge(defs[dep]);
+        }
+        this->_addLocalDefinitions(unit, defs[i]);
+
+        if (relink.find(unit) != relink.end())
         {
-            auto v = kv.second;
-            if (v->kind == StackGraphNodeKind::REFERENCE && _contains_segment(v->symbol, value->symbol))
+            for (auto &sym : this->symbolsForTranslationUnit(unit))
             {
+                auto def = defs[i].find(sym->symbol);
+                if (def != nullptr)
+                {
+                    links[i].push_back({sym, *def});
+                }
+            }
+        }
 
-                auto it = v;
-                while (it->parent != nullptr)
+        for (auto dep : plan.imports[i])
+        {
+            if (--users[dep] == 0)
+            {
+                defs[dep] = SymbolMap();
+            }
+        }
+        if (users[i] == 0)
+        {
+            defs[i] = SymbolMap();
+        }
+    };
+
+    auto worker = [&]()
+    {
+        while (true)
+        {
+            uint32_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]()
+                        { return !ready.empty() || done == count; });
+                if (ready.empty())
                 {
-                    it = it->parent;
+                    return;
                 }
+                i = ready.front();
+                ready.pop_front();
+            }
+
+            link(i);
 
-                auto res = new Coordinate(it->symbol, v->location.line, v->location.column);
-                lst.push_back(shared_ptr<Coordinate>(res));
+            vector<uint32_t> unblocked;
+            for (auto importer : importers[i])
+            {
+                if (--waiting[importer] == 0)
+                {
+                    unblocked.push_back(importer);
+                }
+            }
+            bool finished;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready.insert(ready.end(), unblocked.begin(), unblocked.end());
+                finished = ++done == count;
+            }
+            if (finished)
+            {
+                cv.notify_all();
+            }
+            for (size_t k = 0; k < unblocked.size(); k++)
+            {
+                cv.notify_one();
             }
         }
+    };
+
+    vector<std::thread> workers;
+    for (unsigned int t = 1; t < threads; t++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+
+    for (auto &lst : links)
+    {
+        for (auto &entry : lst)
+        {
+            this->cross_links.push_back(CrossLink(entry.first, entry.second, entry.first->jump_to));
+            this->usages.jump(entry.first, entry.second);
+        }
+    }
+}
+
+void StackGraphEngine::_visitUnitsInTopologicalOrder(
+    unordered_map<string, SymbolMap> &cache,
+    unordered_set<string> &visited,
+    unordered_map<string, string> &h_to_c,
+    string unit,
+    const unordered_set<string> &relink)
+{
+
+    if (visited.find(unit) != visited.end())
+    {
+        return;
+    }
+    visited.insert(unit);
+
+    // std::cout << unit << std::endl;
+
+    auto transitive_defs = this->_importedDefinitions(cache, visited, h_to_c, unit, relink);
+    this->_addLocalDefinitions(unit, transitive_defs);
+
+    // now all the transitive definitions are loaded
+
+    if (relink.find(unit) != relink.end())
+    {
+        this->_linkSymbols(unit, transitive_defs);
+    }
+
+    cache.insert({unit, transitive_defs});
+}
+
+SymbolMap StackGraphEngine::_importedDefinitions(
+    unordered_map<string, SymbolMap> &cache,
+    unordered_set<string> &visited,
+    unordered_map<string, string> &h_to_c,
+    const string &unit,
+    const unordered_set<string> &relink)
+{
+    SymbolMap transitive_defs;
+
+    auto file = this->node_table.file_ids.find(unit);
+    auto id = file == this->node_table.file_ids.end() ? stack_graph::NO_FILE : file->second;
+    for (auto target : this->includes.includesOf(id))
+    {
+        auto &path_import = this->node_table.files[target].path;
+        if (cache.find(path_import) == cache.end() && visited.find(path_import) == visited.end())
+        {
+            this->_visitUnitsInTopologicalOrder(cache, visited, h_to_c, path_import, relink);
+        }
+
+        auto found = cache.find(path_import);
+        if (found != cache.end())
+        {
+            transitive_defs.merge(found->second);
+        }
+    }
+
+    return transitive_defs;
+}
+
+// Own definitions, then those of the paired C file; imported ones win.
+void StackGraphEngine::_addLocalDefinitions(const string &unit, SymbolMap &defs)
+{
+    for (auto &def : this->exportedDefinitionsForTranslationUnit(unit))
+    {
+        defs.insert(def->symbol, def);
+    }
+
+    auto c_file = this->h_to_c.find(unit);
+    if (c_file != this->h_to_c.end())
+    {
+        for (auto &def : this->exportedDefinitionsForTranslationUnit(c_file->second))
+        {
+            defs.insert(def->symbol, def);
+        }
+    }
+}
+
+void StackGraphEngine::_linkSymbols(const string &unit, const SymbolMap &defs)
+{
+    for (auto &sym : this->symbolsForTranslationUnit(unit))
+    {
+        auto def = defs.find(sym->symbol);
+        if (def != nullptr)
+        {
+            this->cross_links.push_back(CrossLink(sym, *def, sym->jump_to));
+            this->usages.jump(sym, *def);
+        }
+    }
+}
+
+unordered_map<string, string> StackGraphEngine::_headersToSources()
+{
+    unordered_map<string, string> h_to_c;
+
+    for (auto &entry : this->translation_units)
+    {
+        auto k = entry.first;
+        auto v = entry.second;
+
+        if (stack_graph::isCFileName(fs::path(k).filename().string()))
+        {
+            auto &file = this->includes.files[this->node_table.file_ids.at(k)];
+            for (size_t i = 0; i < file.spellings.size(); i++)
+            {
+                auto spelling = file.spellings[i];
+                auto target = file.targets[i];
+
+                if (target != stack_graph::NO_FILE && stack_graph::isHeaderFileName(string(this->symbols.text(spelling))))
+                {
+                    h_to_c[this->node_table.files[target].path] = k;
+                }
+            }
+        }
+    }
+
+    return h_to_c;
+}
+
+// Undoes the links out of `units` and links them again; the rest of the
+// units are only visited for the definitions they export.
+void StackGraphEngine::_relink(const unordered_set<string> &units, unsigned int threads)
+{
+    unordered_set<StackGraphTree *> trees;
+    for (auto &unit : units)
+    {
+        auto found = this->translation_units.find(unit);
+        if (found != this->translation_units.end())
+        {
+            trees.insert(found->second.get());
+        }
+    }
+
+    size_t kept = 0;
+    for (auto &link : this->cross_links)
+    {
+        if (trees.count(link.symbol.tree))
+        {
+            this->usages.jump(link.symbol, link.previous);
+            continue;
+        }
+        this->cross_links[kept++] = link;
+    }
+    this->cross_links.resize(kept, CrossLink(NodeRef(), NodeRef()));
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Planned from every unit in path order, so include cycles break where a
+    // full link breaks them, whichever units are relinked or were added.
+    vector<string> paths;
+    paths.reserve(this->translation_units.size());
+    for (auto &entry : this->translation_units)
+    {
+        paths.push_back(entry.first);
+    }
+    std::sort(paths.begin(), paths.end());
+
+    LinkPlan full;
+    for (auto &path : paths)
+    {
+        this->_planLinks(full, this->node_table.file_ids.at(path));
+    }
+    if (units.size() == this->translation_units.size())
+    {
+        this->_linkUnits(full, units, threads);
+        return;
+    }
+
+    // Only the relinked units and what they import need their definitions.
+    // Imports finish first, so one backwards pass finds them all.
+    vector<bool> needed(full.units.size());
+    for (size_t i = full.units.size(); i-- > 0;)
+    {
+        needed[i] = needed[i] || units.count(this->node_table.files[full.units[i]].path);
+        if (needed[i])
+        {
+            for (auto dep : full.imports[i])
+            {
+                needed[dep] = true;
+            }
+        }
+    }
+
+    LinkPlan plan;
+    for (uint32_t i = 0; i < full.units.size(); i++)
+    {
+        if (!needed[i])
+        {
+            continue;
+        }
+        vector<uint32_t> deps;
+        for (auto dep : full.imports[i])
+        {
+            deps.push_back(plan.index.at(full.units[dep]));
+        }
+        plan.index[full.units[i]] = plan.units.size();
+        plan.units.push_back(full.units[i]);
+        plan.imports.push_back(std::move(deps));
+    }
+    this->_linkUnits(plan, units, threads);
+}
+
+void StackGraphEngine::crossLink(unsigned int threads)
+{
+    this->_updateIncludeGraph();
+    this->h_to_c = this->_headersToSources();
+
+    unordered_set<string> units;
+    for (auto &entry : this->translation_units)
+    {
+        units.insert(entry.first);
+    }
+    this->_relink(units, threads);
+}
+
+size_t StackGraphEngine::crossLink(const IndexDelta &delta, unsigned int threads)
+{
+    if (delta.empty())
+    {
+        return 0;
+    }
+
+    this->_updateIncludeGraph();
+    auto h_to_c = this->_headersToSources();
+
+    unordered_set<string> affected(delta.unlinked.begin(), delta.unlinked.end());
+    unordered_set<string> dirty_names;
+    unordered_set<string> changed(delta.changed.begin(), delta.changed.end());
+    for (auto &path : delta.changed)
+    {
+        affected.insert(path);
+        dirty_names.insert(fs::path(path).filename().string());
+    }
+    for (auto &path : delta.removed_paths)
+    {
+        dirty_names.insert(fs::path(path).filename().string());
+    }
+
+    // A header also sees the definitions of its C file, so it is affected
+    // when that pairing changes or the C file does.
+    for (auto &entry : h_to_c)
+    {
+        auto old = this->h_to_c.find(entry.first);
+        if (old == this->h_to_c.end() || old->second != entry.second || changed.count(entry.second))
+        {
+            affected.insert(entry.first);
+        }
+    }
+    for (auto &entry : this->h_to_c)
+    {
+        if (h_to_c.find(entry.first) == h_to_c.end())
+        {
+            affected.insert(entry.first);
+        }
+    }
+    this->h_to_c = h_to_c;
+
+    // Imports are matched by file name, so a unit importing a changed name
+    // may now resolve to a different file, and its importers see that too.
+    unordered_map<string, vector<string>> importers;
+    for (auto &entry : this->translation_units)
+    {
+        for (auto &import : this->importsForTranslationUnit(entry.first))
+        {
+            auto name = fs::path(import).filename().string();
+            importers[name].push_back(entry.first);
+            if (dirty_names.count(name))
+            {
+                affected.insert(entry.first);
+            }
+        }
+    }
+
+    vector<string> queue(affected.begin(), affected.end());
+    while (!queue.empty())
+    {
+        auto unit = queue.back();
+        queue.pop_back();
+
+        auto found = importers.find(fs::path(unit).filename().string());
+        if (found == importers.end())
+        {
+            continue;
+        }
+        for (auto &importer : found->second)
+        {
+            if (affected.insert(importer).second)
+            {
+                queue.push_back(importer);
+            }
+        }
+    }
+
+    unordered_set<string> units;
+    for (auto &unit : affected)
+    {
+        if (this->translation_units.find(unit) != this->translation_units.end())
+        {
+            units.insert(unit);
+        }
+    }
+
+    this->_relink(units, threads);
+    return units.size();
+}
+
+vector<shared_ptr<Coordinate>> StackGraphEngine::findUsages(Coordinate coord)
+{
+    vector<shared_ptr<Coordinate>> lst;
+    auto value = this->node_table.find(coord.path, coord.line, coord.column);
+    if (value == nullptr)
+    {
+        return lst;
+    }
+
+    // Types are used by the symbols jumping to them, fields and variables
+    // by the references naming them in any segment.
+    vector<tuple<uint32_t, Point, NodeRef>> hits;
+    if (value->kind == StackGraphNodeKind::NAMED_SCOPE)
+    {
+        for (auto &v : this->usages.find(value))
+        {
+            auto file = this->node_table.fileOf(v.tree);
+            if (v->kind == StackGraphNodeKind::SYMBOL && file != stack_graph::NO_FILE)
+            {
+                hits.push_back({file, v->location, v});
+            }
+        }
+    }
+    else if (value->kind == StackGraphNodeKind::SYMBOL)
+    {
+        for (auto &hit : this->references.find(value->symbol))
+        {
+            hits.push_back({hit.file, hit.node->location, hit.node});
+        }
+    }
+
+    // Sorted into node table order. Where nodes share a position, only the
+    // one the table keeps is reported.
+    std::sort(hits.begin(), hits.end(), [](auto &a, auto &b)
+              { auto &p = std::get<1>(a), &q = std::get<1>(b);
+                return std::tie(std::get<0>(a), p.line, p.column) < std::tie(std::get<0>(b), q.line, q.column); });
+
+    lst.reserve(hits.size());
+    for (auto &[file, at, v] : hits)
+    {
+        if (this->node_table.visible(file, v.id))
+        {
+            lst.push_back(std::make_shared<Coordinate>(this->node_table.files[file].path, at.line, at.column));
+        }
     }
 
     return lst;
-}
\ No newline at end of file
+}
+
+stack_graph::EngineStats StackGraphEngine::stats()
+{
+    EngineStats s;
+    s.translation_units = this->translation_units.size();
+    s.nodes = this->node_table.size();
+    s.node_table_bytes = this->node_table.memoryUsage();
+    s.usage_index_bytes = this->usages.memoryUsage();
+    s.reference_index_bytes = this->references.memoryUsage();
+    s.include_graph_bytes = this->includes.memoryUsage();
+    s.resolution_table_bytes = this->resolutions.memoryUsage();
+    s.symbols = this->symbols.stats();
+    s.tree_bytes = 0;
+    for (auto &entry : this->translation_units)
+    {
+        s.tree_bytes += entry.second->memoryUsage();
+    }
+    s.parsers_created = this->parsers.created;
+    s.bytes_read = this->bytes_read;
+    s.bytes_copied = this->bytes_copied;
+    return s;
+}
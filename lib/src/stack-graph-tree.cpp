@@ -17,10 +17,16 @@ using std::string;
 using std::stringstream;
 using std::vector;
 
+using stack_graph::NO_NODE;
+using stack_graph::NodeId;
+using stack_graph::NodeRef;
 using stack_graph::Point;
 using stack_graph::Range;
 using stack_graph::StackGraphNode;
 using stack_graph::StackGraphNodeKind;
+using stack_graph::StackGraphTree;
+using stack_graph::StringInterner;
+using stack_graph::SymbolId;
 
 struct TSNodeWrapper;
 void _do_print_repr(stringstream &ss, TSNodeWrapper node, int level);
@@ -61,7 +67,7 @@ struct TSNodeWrapper
         return shared_ptr<TSNodeWrapper>(new TSNodeWrapper(ts_node_child(this->tsnode, ind)));
     }
 
-    string text(string &code)
+    std::string_view text(std::string_view code)
     {
         return code.substr(this->range().start, this->range().end - this->range().start);
     }
@@ -108,226 +114,484 @@ const char *kind_names[] = {
     "UNNAMED_SCOPE",
     "IMPORT"};
 
-void _do_print_repr_stree(stringstream &ss, StackGraphNode node, int level);
+void _do_print_repr_stree(stringstream &ss, NodeRef node, int level);
 
-std::string StackGraphNode::repr()
+NodeId StackGraphTree::add(StackGraphNodeKind kind, SymbolId symbol, Point location, NodeId parent)
+{
+    NodeId id = this->nodes.size();
+    this->nodes.emplace_back(kind, symbol, location);
+    this->nodes[id].parent = parent;
+
+    if (parent != NO_NODE)
+    {
+        if (!this->wide_scopes.empty())
+        {
+            this->wide_scopes.erase(parent);
+        }
+        auto &p = this->nodes[parent];
+        if (p.last_child == NO_NODE)
+        {
+            p.first_child = id;
+        }
+        else
+        {
+            this->nodes[p.last_child].next_sibling = id;
+        }
+        p.last_child = id;
+    }
+    return id;
+}
+
+NodeId StackGraphTree::findChild(NodeId scope, SymbolId symbol)
+{
+    size_t scanned = 0;
+    for (NodeId id = this->nodes[scope].first_child; id != NO_NODE; id = this->nodes[id].next_sibling)
+    {
+        if (this->nodes[id].symbol == symbol)
+        {
+            return id;
+        }
+        if (++scanned < WIDE_SCOPE || this->nodes[id].next_sibling == NO_NODE)
+        {
+            continue;
+        }
+
+        // Not among the first children, so the first match overall is the
+        // one the index keeps.
+        std::lock_guard<std::mutex> lock(this->wide_scopes_mutex);
+        auto found = this->wide_scopes.find(scope);
+        if (found == this->wide_scopes.end())
+        {
+            found = this->wide_scopes.insert({scope, {}}).first;
+            for (NodeId child = this->nodes[scope].first_child; child != NO_NODE; child = this->nodes[child].next_sibling)
+            {
+                found->second.emplace(this->nodes[child].symbol, child);
+            }
+        }
+        auto child = found->second.find(symbol);
+        return child == found->second.end() ? NO_NODE : child->second;
+    }
+    return NO_NODE;
+}
+
+size_t StackGraphTree::memoryUsage()
+{
+    size_t bytes = sizeof(StackGraphTree) + this->nodes.capacity() * sizeof(StackGraphNode);
+    std::lock_guard<std::mutex> lock(this->wide_scopes_mutex);
+    for (auto &scope : this->wide_scopes)
+    {
+        bytes += scope.second.bucket_count() * sizeof(void *) + scope.second.size() * (sizeof(std::pair<SymbolId, NodeId>) + sizeof(void *));
+    }
+    return bytes;
+}
+
+string StackGraphTree::repr()
+{
+    return this->root().repr();
+}
+
+std::string NodeRef::repr() const
 {
     stringstream ss;
     _do_print_repr_stree(ss, *this, 0);
     return ss.str();
 }
 
-void _do_print_repr_stree(stringstream &ss, StackGraphNode node, int level)
+void _do_print_repr_stree(stringstream &ss, NodeRef node, int level)
 {
     for (int i = 0; i < level; i++)
     {
         ss << "|  ";
     }
-    ss << "|-" << kind_names[node.kind] << "[" << node.symbol << "]" << "(" << node.location.line << "," << node.location.column << ")";
-    if (node.jump_to != nullptr)
+    ss << "|-" << kind_names[node->kind] << "[" << node.symbolText() << "]" << "(" << node->location.line << "," << node->location.column << ")";
+    if (node->jump_to != nullptr)
     {
-        ss << "~> " << node.jump_to->_type;
+        ss << "~> " << node->jump_to.typeText();
     }
     ss << std::endl;
 
-    for (auto ch : node.children)
+    for (auto ch : node.children())
     {
-        _do_print_repr_stree(ss, *ch, level + 1);
+        _do_print_repr_stree(ss, ch, level + 1);
     }
 }
 
+// Syntax node kinds the builders care about. Everything else is SK_OTHER.
+enum _SyntaxKind : uint8_t
+{
+    SK_OTHER,
+    SK_ERROR,
+    SK_IDENTIFIER,
+    SK_FIELD_IDENTIFIER,
+    SK_TYPE_IDENTIFIER,
+    SK_TRANSLATION_UNIT,
+    SK_FUNCTION_DEFINITION,
+    SK_FUNCTION_DECLARATOR,
+    SK_COMPOUND_STATEMENT,
+    SK_DECLARATION,
+    SK_PARAMETER_DECLARATION,
+    SK_FIELD_DECLARATION,
+    SK_STRUCT_SPECIFIER,
+    SK_ENUM_SPECIFIER,
+    SK_PREPROC_INCLUDE,
+    SK_CALL_EXPRESSION,
+    SK_FIELD_EXPRESSION,
+    SK_POINTER_EXPRESSION,
+    SK_SUBSCRIPT_EXPRESSION
+};
+
+// Maps tree-sitter symbol ids to _SyntaxKind, so the builders dispatch on
+// ts_node_symbol instead of comparing ts_node_type strings.
+struct _SyntaxKinds
+{
+    vector<_SyntaxKind> by_symbol;
+    TSSymbol error;
+
+    _SyntaxKinds(const TSLanguage *language) : by_symbol(ts_language_symbol_count(language), SK_OTHER)
+    {
+        const std::pair<const char *, _SyntaxKind> names[] = {
+            {"identifier", SK_IDENTIFIER},
+            {"field_identifier", SK_FIELD_IDENTIFIER},
+            {"type_identifier", SK_TYPE_IDENTIFIER},
+            {"translation_unit", SK_TRANSLATION_UNIT},
+            {"function_definition", SK_FUNCTION_DEFINITION},
+            {"function_declarator", SK_FUNCTION_DECLARATOR},
+            {"compound_statement", SK_COMPOUND_STATEMENT},
+            {"declaration", SK_DECLARATION},
+            {"parameter_declaration", SK_PARAMETER_DECLARATION},
+            {"field_declaration", SK_FIELD_DECLARATION},
+            {"struct_specifier", SK_STRUCT_SPECIFIER},
+            {"enum_specifier", SK_ENUM_SPECIFIER},
+            {"preproc_include", SK_PREPROC_INCLUDE},
+            {"call_expression", SK_CALL_EXPRESSION},
+            {"field_expression", SK_FIELD_EXPRESSION},
+            {"pointer_expression", SK_POINTER_EXPRESSION},
+            {"subscript_expression", SK_SUBSCRIPT_EXPRESSION}};
+
+        for (auto &name : names)
+        {
+            auto symbol = ts_language_symbol_for_name(language, name.first, strlen(name.first), true);
+            if (symbol < this->by_symbol.size())
+            {
+                this->by_symbol[symbol] = name.second;
+            }
+        }
+        this->error = ts_language_symbol_for_name(language, "ERROR", strlen("ERROR"), true);
+    }
+
+    _SyntaxKind of(TSNode node) const
+    {
+        auto symbol = ts_node_symbol(node);
+        if (symbol < this->by_symbol.size())
+        {
+            return this->by_symbol[symbol];
+        }
+        return symbol == this->error ? SK_ERROR : SK_OTHER;
+    }
+};
+
+// The server only parses C, so the table is resolved once, on first use.
+const _SyntaxKinds &_syntax_kinds(const TSLanguage *language)
+{
+    static const _SyntaxKinds kinds(language);
+    return kinds;
+}
+
+bool _is_reference_kind(_SyntaxKind kind)
+{
+    return kind == SK_IDENTIFIER || kind == SK_CALL_EXPRESSION || kind == SK_FIELD_EXPRESSION || kind == SK_POINTER_EXPRESSION || kind == SK_SUBSCRIPT_EXPRESSION;
+}
+
+enum _State
+{
+    STATE_NONE,
+    STATE_FUNCTION_DEFINITION,
+    STATE_FUNCTION_DECLARATOR,
+    STATE_POPULATE_TYPE,
+    STATE_DECLARATION,
+    STATE_SKIP_COMPOUND,
+    STATE_REFERENCE
+};
+
 struct _Context
 {
-    string state;
-    shared_ptr<StackGraphNode> jump_to;
+    _State state;
+    NodeId jump_to;
     string type;
     Point location;
 
     _Context()
     {
-        state = "";
-        jump_to = nullptr;
+        state = STATE_NONE;
+        jump_to = NO_NODE;
         type = "";
     }
 };
 
-shared_ptr<StackGraphNode> try_resolve_type(vector<shared_ptr<StackGraphNode>> cpy_stack, string type)
+// The first NAMED_SCOPE child of the given type in the innermost scope of
+// the stack that has one.
+NodeId try_resolve_type(StackGraphTree &tree, const vector<NodeId> &stack, SymbolId type)
 {
-    if (cpy_stack.size() == 0)
+    for (size_t depth = stack.size(); depth-- > 0;)
     {
-        return nullptr;
+        for (auto ch = tree.nodes[stack[depth]].first_child; ch != NO_NODE; ch = tree.nodes[ch].next_sibling)
+        {
+            if (tree.nodes[ch]._type == type && tree.nodes[ch].kind == StackGraphNodeKind::NAMED_SCOPE)
+            {
+                return ch;
+            }
+        }
     }
+    return NO_NODE;
+}
 
-    shared_ptr<StackGraphNode> it;
-    while (cpy_stack.size() != 0)
+// Answers try_resolve_type without scanning the stack. Each type maps to the
+// first definition in each scope on the stack that holds one, ordered by
+// the depth of that scope, so the innermost is at the back. Builders
+// report named scopes as they appear and call leave before popping a scope.
+struct _TypeScopes
+{
+    struct Definition
     {
-        it = cpy_stack.back();
-        cpy_stack.pop_back();
+        size_t depth;
+        NodeId node;
+    };
+
+    std::unordered_map<SymbolId, vector<Definition>> types;
+    vector<vector<SymbolId>> defined;
+
+    // `node` became a NAMED_SCOPE of its current type, as a child of the
+    // scope at `depth`.
+    void define(StackGraphTree &tree, size_t depth, NodeId node)
+    {
+        auto type = tree.nodes[node]._type;
+        auto &definitions = this->types[type];
+        auto it = definitions.end();
+        while (it != definitions.begin() && (it - 1)->depth > depth)
+        {
+            --it;
+        }
+        if (it != definitions.begin() && (it - 1)->depth == depth)
+        {
+            return;
+        }
+        definitions.insert(it, {depth, node});
+        if (this->defined.size() <= depth)
+        {
+            this->defined.resize(depth + 1);
+        }
+        this->defined[depth].push_back(type);
+    }
+
+    // `node` changed its type from `previous`. It is the newest child of its
+    // scope, so no later definition was shadowed by it.
+    void retype(StackGraphTree &tree, size_t depth, NodeId node, SymbolId previous)
+    {
+        auto found = this->types.find(previous);
+        if (found != this->types.end() && !found->second.empty() && found->second.back().node == node)
+        {
+            found->second.pop_back();
+        }
+        this->define(tree, depth, node);
+    }
 
-        for (auto ch : it->children)
+    void leave(size_t depth)
+    {
+        if (depth >= this->defined.size())
+        {
+            return;
+        }
+        for (auto type : this->defined[depth])
         {
-            if (ch->_type == type && ch->kind == StackGraphNodeKind::NAMED_SCOPE)
+            auto &definitions = this->types[type];
+            if (!definitions.empty() && definitions.back().depth == depth)
             {
-                return ch;
+                definitions.pop_back();
             }
         }
+        this->defined[depth].clear();
     }
-    return nullptr;
-}
 
-void build_stack_graph(vector<shared_ptr<StackGraphNode>> &stack, string &code, TSNodeWrapper node, _Context &ctx)
+    NodeId find(StackGraphTree &tree, const vector<NodeId> &stack, std::string_view type_text)
+    {
+        SymbolId type = tree.symbols->find(type_text);
+        if (stack.size() == 0 || type == stack_graph::NO_SYMBOL)
+        {
+            return NO_NODE;
+        }
+
+        auto found = this->types.find(type);
+        if (found == this->types.end() || found->second.empty())
+        {
+            return NO_NODE;
+        }
+
+        // A definition that has since changed falls back to the scan.
+        auto &definition = found->second.back();
+        auto &node = tree.nodes[definition.node];
+        if (definition.depth < stack.size() && node.parent == stack[definition.depth] &&
+            node.kind == StackGraphNodeKind::NAMED_SCOPE && node._type == type)
+        {
+            return definition.node;
+        }
+        return try_resolve_type(tree, stack, type);
+    }
+};
+
+void build_stack_graph(StackGraphTree &tree, vector<NodeId> &stack, _TypeScopes &types, std::string_view code, const _SyntaxKinds &kinds, TSNodeWrapper node, _Context &ctx)
 {
+    auto kind = kinds.of(node.tsnode);
 
-    if (strcmp(node.type(), "ERROR") == 0)
+    if (kind == SK_ERROR)
     {
         return;
     }
-    else if (strcmp(node.type(), "identifier") == 0 && ctx.state == "function_declarator")
+    else if (kind == SK_IDENTIFIER && ctx.state == STATE_FUNCTION_DECLARATOR)
     {
-        stack.back()->symbol = node.text(code);
-        stack.back()->_type = node.text(code);
-        stack.back()->location = node.editorPosition();
+        auto &function_node = tree.nodes[stack.back()];
+        auto previous = function_node._type;
+        function_node.symbol = tree.symbols->intern(node.text(code));
+        function_node._type = function_node.symbol;
+        function_node.location = node.editorPosition();
+        types.retype(tree, stack.size() - 2, stack.back(), previous);
     }
-    if (strcmp(node.type(), "function_declarator") == 0 && ctx.state == "function_definition")
+    if (kind == SK_FUNCTION_DECLARATOR && ctx.state == STATE_FUNCTION_DEFINITION)
     {
         auto id_node = node.childByFieldName("declarator");
         _Context ctx2;
-        ctx2.state = "function_declarator";
-        build_stack_graph(stack, code, std::move(*id_node), ctx2);
+        ctx2.state = STATE_FUNCTION_DECLARATOR;
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*id_node), ctx2);
 
         auto parameters_node = node.childByFieldName("parameters");
-        build_stack_graph(stack, code, std::move(*parameters_node), ctx);
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*parameters_node), ctx);
     }
-    else if (strcmp(node.type(), "type_identifier") == 0 && ctx.state == "populate_type")
+    else if (kind == SK_TYPE_IDENTIFIER && ctx.state == STATE_POPULATE_TYPE)
     {
-        ctx.type = node.text(code);
+        ctx.type = string(node.text(code));
         ctx.location = node.editorPosition();
     }
-    else if ((strcmp(node.type(), "identifier") == 0 || strcmp(node.type(), "field_identifier") == 0) && ctx.state == "declaration")
+    else if ((kind == SK_IDENTIFIER || kind == SK_FIELD_IDENTIFIER) && ctx.state == STATE_DECLARATION)
     {
-        auto symbol_node = new StackGraphNode(StackGraphNodeKind::SYMBOL, node.text(code), node.editorPosition());
-        symbol_node->parent = stack.back();
-        symbol_node->jump_to = ctx.jump_to;
-        symbol_node->_type = ctx.type;
-        auto symbol_node_ptr = shared_ptr<StackGraphNode>(symbol_node);
-        stack.back()->children.push_back(symbol_node_ptr);
+        auto symbol_node = tree.add(StackGraphNodeKind::SYMBOL, tree.symbols->intern(node.text(code)), node.editorPosition(), stack.back());
+        tree.nodes[symbol_node].jump_to = ctx.jump_to == NO_NODE ? NodeRef() : NodeRef(&tree, ctx.jump_to);
+        tree.nodes[symbol_node]._type = tree.symbols->intern(ctx.type);
     }
-    else if (strcmp(node.type(), "compound_statement") == 0)
+    else if (kind == SK_COMPOUND_STATEMENT)
     {
-        if (ctx.state != "skip_compound")
+        if (ctx.state != STATE_SKIP_COMPOUND)
         {
-            auto symbol_node = new StackGraphNode(StackGraphNodeKind::UNNAMED_SCOPE, "", node.editorPosition());
-            symbol_node->parent = stack.back();
-            auto symbol_node_ptr = shared_ptr<StackGraphNode>(symbol_node);
-            stack.back()->children.push_back(symbol_node_ptr);
-            stack.push_back(symbol_node_ptr);
+            auto symbol_node = tree.add(StackGraphNodeKind::UNNAMED_SCOPE, stack_graph::EMPTY_SYMBOL, node.editorPosition(), stack.back());
+            stack.push_back(symbol_node);
         }
 
         for (uint32_t i = 0; i < node.child_count(); i++)
         {
-            build_stack_graph(stack, code, std::move(*node.child(i)), ctx);
+            build_stack_graph(tree, stack, types, code, kinds, std::move(*node.child(i)), ctx);
         }
 
-        if (ctx.state != "skip_compound")
+        if (ctx.state != STATE_SKIP_COMPOUND)
         {
+            types.leave(stack.size() - 1);
             stack.pop_back();
         }
     }
-    else if (strcmp(node.type(), "declaration") == 0 || strcmp(node.type(), "parameter_declaration") == 0 || strcmp(node.type(), "field_declaration") == 0)
+    else if (kind == SK_DECLARATION || kind == SK_PARAMETER_DECLARATION || kind == SK_FIELD_DECLARATION)
     {
         auto specifiers_node = node.childByFieldName("type");
         _Context ctx2;
-        ctx2.state = "populate_type";
-        build_stack_graph(stack, code, std::move(*specifiers_node), ctx2);
+        ctx2.state = STATE_POPULATE_TYPE;
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*specifiers_node), ctx2);
 
-        if (ctx2.jump_to == nullptr)
+        if (ctx2.jump_to == NO_NODE)
         {
-            ctx2.jump_to = try_resolve_type(stack, ctx2.type);
+            ctx2.jump_to = types.find(tree, stack, ctx2.type);
         }
 
         for (uint32_t i = 1; i < node.child_count(); i += 2)
         {
-            ctx2.state = "declaration";
-            build_stack_graph(stack, code, std::move(*node.child(i)), ctx2);
+            ctx2.state = STATE_DECLARATION;
+            build_stack_graph(tree, stack, types, code, kinds, std::move(*node.child(i)), ctx2);
         }
     }
-    else if (strcmp(node.type(), "translation_unit") == 0)
+    else if (kind == SK_TRANSLATION_UNIT)
     {
-        auto sg_node = shared_ptr<StackGraphNode>(new StackGraphNode(StackGraphNodeKind::NAMED_SCOPE, "translation_unit", node.editorPosition()));
-        sg_node->_type = "root";
+        auto sg_node = tree.add(StackGraphNodeKind::NAMED_SCOPE, tree.symbols->intern("translation_unit"), node.editorPosition(), NO_NODE);
+        tree.nodes[sg_node]._type = tree.symbols->intern("root");
         stack.push_back(sg_node);
 
         for (uint32_t i = 0; i < node.child_count(); i++)
         {
-            build_stack_graph(stack, code, std::move(*node.child(i)), ctx);
+            build_stack_graph(tree, stack, types, code, kinds, std::move(*node.child(i)), ctx);
         }
     }
-    else if (strcmp(node.type(), "struct_specifier") == 0 || strcmp(node.type(), "enum_specifier") == 0)
+    else if (kind == SK_STRUCT_SPECIFIER || kind == SK_ENUM_SPECIFIER)
     {
         auto symbol_node = node.childByFieldName("name");
         auto kind = symbol_node != nullptr ? StackGraphNodeKind::NAMED_SCOPE : StackGraphNodeKind::UNNAMED_SCOPE;
         auto symbol_node_text = symbol_node != nullptr ? symbol_node->text(code) : "";
+        auto symbol_node_id = tree.symbols->intern(symbol_node_text);
 
-        StackGraphNode *struct_node = new StackGraphNode(kind, symbol_node_text, node.editorPosition());
-        struct_node->parent = stack.back();
-        struct_node->_type = symbol_node_text;
+        auto struct_node = tree.add(kind, symbol_node_id, node.editorPosition(), stack.back());
+        tree.nodes[struct_node]._type = symbol_node_id;
         if (symbol_node != nullptr)
         {
-            struct_node->location = symbol_node->editorPosition();
+            tree.nodes[struct_node].location = symbol_node->editorPosition();
         }
-        auto struct_node_ptr = shared_ptr<StackGraphNode>(struct_node);
-        stack.back()->children.push_back(struct_node_ptr);
-        stack.push_back(struct_node_ptr);
+        stack.push_back(struct_node);
 
-        if (ctx.state == "populate_type")
+        auto field_decl_list_node = node.childByFieldName("body");
+        if (kind == StackGraphNodeKind::NAMED_SCOPE && field_decl_list_node != nullptr)
         {
-            ctx.jump_to = struct_node_ptr;
-            ctx.type = symbol_node_text;
+            types.define(tree, stack.size() - 2, struct_node);
+        }
+
+        if (ctx.state == STATE_POPULATE_TYPE)
+        {
+            ctx.jump_to = struct_node;
+            ctx.type = string(symbol_node_text);
         }
         else
         {
-            ctx.type = symbol_node_text;
+            ctx.type = string(symbol_node_text);
         }
 
-        auto field_decl_list_node = node.childByFieldName("body");
-
         if (field_decl_list_node != nullptr)
         {
-            build_stack_graph(stack, code, std::move(*field_decl_list_node), ctx);
+            build_stack_graph(tree, stack, types, code, kinds, std::move(*field_decl_list_node), ctx);
         }
         else
         {
-            stack.back()->kind = StackGraphNodeKind::SYMBOL;
-            vector<shared_ptr<StackGraphNode>> cpy_stack(stack);
-            stack.back()->jump_to = try_resolve_type(cpy_stack, symbol_node_text);
+            tree.nodes[stack.back()].kind = StackGraphNodeKind::SYMBOL;
+            auto type_node = types.find(tree, stack, symbol_node_text);
+            tree.nodes[stack.back()].jump_to = type_node == NO_NODE ? NodeRef() : NodeRef(&tree, type_node);
         }
 
+        types.leave(stack.size() - 1);
         stack.pop_back();
     }
 
-    else if (strcmp(node.type(), "function_definition") == 0)
+    else if (kind == SK_FUNCTION_DEFINITION)
     {
         auto kind = StackGraphNodeKind::NAMED_SCOPE;
 
-        StackGraphNode *function_node = new StackGraphNode(kind, "", node.editorPosition());
-        function_node->parent = stack.back();
-        auto function_node_ptr = shared_ptr<StackGraphNode>(function_node);
-        stack.back()->children.push_back(function_node_ptr);
-        stack.push_back(function_node_ptr);
+        auto function_node = tree.add(kind, stack_graph::EMPTY_SYMBOL, node.editorPosition(), stack.back());
+        types.define(tree, stack.size() - 1, function_node);
+        stack.push_back(function_node);
 
         auto declarator_node = node.childByFieldName("declarator");
         _Context ctx2;
-        ctx2.state = "function_definition";
+        ctx2.state = STATE_FUNCTION_DEFINITION;
 
-        build_stack_graph(stack, code, std::move(*declarator_node), ctx2);
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*declarator_node), ctx2);
 
-        ctx2.state = "skip_compound";
+        ctx2.state = STATE_SKIP_COMPOUND;
         auto body_node = node.childByFieldName("body");
-        build_stack_graph(stack, code, std::move(*body_node), ctx2);
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*body_node), ctx2);
 
+        types.leave(stack.size() - 1);
         stack.pop_back();
     }
-    else if (strcmp(node.type(), "preproc_include") == 0)
+    else if (kind == SK_PREPROC_INCLUDE)
     {
 
         auto include_node = node.childByFieldName("path");
@@ -335,68 +599,469 @@ void build_stack_graph(vector<shared_ptr<StackGraphNode>> &stack, string &code,
         auto text = include_node->text(code);
         text = text.substr(1, text.size() - 2);
 
-        auto n = shared_ptr<StackGraphNode>(new StackGraphNode(StackGraphNodeKind::IMPORT, text, node.editorPosition()));
-
-        n->parent = stack.back();
-        stack.back()->children.push_back(n);
+        tree.add(StackGraphNodeKind::IMPORT, tree.symbols->intern(text), node.editorPosition(), stack.back());
     }
-    else if (strcmp(node.type(), "identifier") == 0 && ctx.state == "reference")
+    else if (kind == SK_IDENTIFIER && ctx.state == STATE_REFERENCE)
     {
-        ctx.type = node.text(code);
+        ctx.type = string(node.text(code));
     }
-    else if (strcmp(node.type(), "call_expression") == 0 && ctx.state == "reference")
+    else if (kind == SK_CALL_EXPRESSION && ctx.state == STATE_REFERENCE)
     {
         auto val = node.childByFieldName("function");
-        build_stack_graph(stack, code, std::move(*val), ctx);
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*val), ctx);
     }
-    else if (strcmp(node.type(), "pointer_expression") == 0 && ctx.state == "reference")
+    else if (kind == SK_POINTER_EXPRESSION && ctx.state == STATE_REFERENCE)
     {
         auto val = node.childByFieldName("argument");
-        build_stack_graph(stack, code, std::move(*val), ctx);
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*val), ctx);
     }
-    else if (strcmp(node.type(), "subscript_expression") == 0 && ctx.state == "reference")
+    else if (kind == SK_SUBSCRIPT_EXPRESSION && ctx.state == STATE_REFERENCE)
     {
         auto val = node.childByFieldName("argument");
-        build_stack_graph(stack, code, std::move(*val), ctx);
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*val), ctx);
     }
-    else if (strcmp(node.type(), "field_expression") == 0 && ctx.state == "reference")
+    else if (kind == SK_FIELD_EXPRESSION && ctx.state == STATE_REFERENCE)
     {
         auto val = node.childByFieldName("argument");
-        build_stack_graph(stack, code, std::move(*val), ctx);
+        build_stack_graph(tree, stack, types, code, kinds, std::move(*val), ctx);
         auto val2 = node.childByFieldName("field");
-        ctx.type = ctx.type + "." + val2->text(code);
+        ctx.type = ctx.type + "." + string(val2->text(code));
     }
-    else if (strcmp(node.type(), "identifier") == 0 || strcmp(node.type(), "call_expression") == 0 || strcmp(node.type(), "field_expression") == 0 || strcmp(node.type(), "pointer_expression") == 0 || strcmp(node.type(), "subscript_expression") == 0)
+    else if (_is_reference_kind(kind))
     {
         _Context ctx2;
-        ctx2.state = "reference";
-        ctx2.type = "";
-
+        ctx2.state = STATE_REFERENCE;
+        
         TSNodeWrapper node_cpy(node);
-        build_stack_graph(stack, code, node_cpy, ctx2);
+        build_stack_graph(tree, stack, types, code, kinds, node_cpy, ctx2);
         auto ref_text = ctx2.type;
 
-        auto ref_node = new StackGraphNode(StackGraphNodeKind::REFERENCE, ref_text, node.editorPosition());
-        ref_node->parent = stack.back();
-        auto ref_node_ptr = shared_ptr<StackGraphNode>(ref_node);
-
-        stack.back()->children.push_back(ref_node_ptr);
+        tree.add(StackGraphNodeKind::REFERENCE, tree.symbols->intern(ref_text), node.editorPosition(), stack.back());
     }
     else
     {
         for (uint32_t i = 0; i < node.child_count(); i++)
         {
-            build_stack_graph(stack, code, std::move(*node.child(i)), ctx);
+            build_stack_graph(tree, stack, types, code, kinds, std::move(*node.child(i)), ctx);
         }
     }
 }
 
-shared_ptr<StackGraphNode> stack_graph::build_stack_graph_tree(TSNode root, const char *source_code)
+// The cursor builder below walks the same rules as build_stack_graph, but keeps
+// its own frame stack instead of recursing and moves over children with one
+// reusable TSTreeCursor per depth, so nothing is allocated per syntax node.
+enum _Rule
+{
+    RULE_CHILDREN,
+    RULE_FUNCTION_DECLARATOR,
+    RULE_COMPOUND,
+    RULE_DECLARATION,
+    RULE_STRUCT,
+    RULE_FUNCTION_DEFINITION,
+    RULE_REFERENCE_FIELD,
+    RULE_REFERENCE_ARGUMENT,
+    RULE_REFERENCE
+};
+
+struct _Frame
+{
+    TSNode node;
+    _Rule rule;
+    size_t ctx;
+    size_t own_ctx;
+    uint32_t step;
+    uint32_t index;
+    bool pushed;
+};
+
+struct _CursorBuilder
 {
+    StackGraphTree &tree;
+    vector<NodeId> &stack;
+    std::string_view code;
+    const _SyntaxKinds &kinds;
+    vector<_Frame> frames;
+    vector<_Context> contexts;
+    vector<TSTreeCursor> cursors;
+    _TypeScopes types;
 
-    vector<shared_ptr<StackGraphNode>> stack;
-    string code = source_code;
-    _Context context;
-    build_stack_graph(stack, code, root, context);
-    return stack.size() == 0 ? nullptr : stack.back();
-}
\ No newline at end of file
+    _CursorBuilder(StackGraphTree &tree, vector<NodeId> &stack, std::string_view code, const _SyntaxKinds &kinds) : tree(tree), stack(stack), code(code), kinds(kinds) {}
+
+    ~_CursorBuilder()
+    {
+        for (auto &cursor : this->cursors)
+        {
+            ts_tree_cursor_delete(&cursor);
+        }
+    }
+
+    std::string_view text(TSNode node)
+    {
+        auto start = ts_node_start_byte(node);
+        return this->code.substr(start, ts_node_end_byte(node) - start);
+    }
+
+    Point position(TSNode node)
+    {
+        TSPoint point = ts_node_start_point(node);
+        struct Point _point = {.line = point.row, .column = point.column};
+        return _point;
+    }
+
+    size_t newContext(_State state)
+    {
+        this->contexts.emplace_back();
+        this->contexts.back().state = state;
+        return this->contexts.size() - 1;
+    }
+
+    // Moves the cursor of the frame at `depth` to its next child. The frame
+    // owns cursors[depth]; deeper frames only ever touch deeper cursors.
+    bool nextChild(size_t depth, TSNode &child)
+    {
+        auto &frame = this->frames[depth];
+        while (this->cursors.size() <= depth)
+        {
+            this->cursors.push_back(ts_tree_cursor_new(frame.node));
+        }
+        auto cursor = &this->cursors[depth];
+
+        bool found;
+        if (frame.index == 0)
+        {
+            ts_tree_cursor_reset(cursor, frame.node);
+            found = ts_tree_cursor_goto_first_child(cursor);
+        }
+        else
+        {
+            found = ts_tree_cursor_goto_next_sibling(cursor);
+        }
+        if (!found)
+        {
+            return false;
+        }
+        frame.index++;
+        child = ts_tree_cursor_current_node(cursor);
+        return true;
+    }
+
+    TSNode field(TSNode node, const char *name)
+    {
+        return ts_node_child_by_field_name(node, name, strlen(name));
+    }
+
+    // Applies the leaf rules of build_stack_graph to `node` and pushes a frame
+    // for rules that visit further nodes.
+    void enter(TSNode node, size_t ctx_id)
+    {
+        auto kind = this->kinds.of(node);
+        auto &ctx = this->contexts[ctx_id];
+
+        if (kind == SK_ERROR)
+        {
+            return;
+        }
+        else if (kind == SK_IDENTIFIER && ctx.state == STATE_FUNCTION_DECLARATOR)
+        {
+            auto &function_node = this->tree.nodes[this->stack.back()];
+            auto previous = function_node._type;
+            function_node.symbol = this->tree.symbols->intern(this->text(node));
+            function_node._type = function_node.symbol;
+            function_node.location = this->position(node);
+            this->types.retype(this->tree, this->stack.size() - 2, this->stack.back(), previous);
+        }
+
+        _Frame frame = {.node = node, .rule = RULE_CHILDREN, .ctx = ctx_id, .own_ctx = SIZE_MAX, .step = 0, .index = 0, .pushed = false};
+
+        if (kind == SK_FUNCTION_DECLARATOR && ctx.state == STATE_FUNCTION_DEFINITION)
+        {
+            frame.rule = RULE_FUNCTION_DECLARATOR;
+            frame.own_ctx = this->newContext(STATE_FUNCTION_DECLARATOR);
+        }
+        else if (kind == SK_TYPE_IDENTIFIER && ctx.state == STATE_POPULATE_TYPE)
+        {
+            ctx.type = string(this->text(node));
+            ctx.location = this->position(node);
+            return;
+        }
+        else if ((kind == SK_IDENTIFIER || kind == SK_FIELD_IDENTIFIER) && ctx.state == STATE_DECLARATION)
+        {
+            auto symbol_node = this->tree.add(StackGraphNodeKind::SYMBOL, this->tree.symbols->intern(this->text(node)), this->position(node), this->stack.back());
+            this->tree.nodes[symbol_node].jump_to = ctx.jump_to == NO_NODE ? NodeRef() : NodeRef(&this->tree, ctx.jump_to);
+            this->tree.nodes[symbol_node]._type = this->tree.symbols->intern(ctx.type);
+            return;
+        }
+        else if (kind == SK_COMPOUND_STATEMENT)
+        {
+            frame.rule = RULE_COMPOUND;
+            if (ctx.state != STATE_SKIP_COMPOUND)
+            {
+                this->stack.push_back(this->tree.add(StackGraphNodeKind::UNNAMED_SCOPE, stack_graph::EMPTY_SYMBOL, this->position(node), this->stack.back()));
+                frame.pushed = true;
+            }
+        }
+        else if (kind == SK_DECLARATION || kind == SK_PARAMETER_DECLARATION || kind == SK_FIELD_DECLARATION)
+        {
+            frame.rule = RULE_DECLARATION;
+            frame.own_ctx = this->newContext(STATE_POPULATE_TYPE);
+        }
+        else if (kind == SK_TRANSLATION_UNIT)
+        {
+            auto sg_node = this->tree.add(StackGraphNodeKind::NAMED_SCOPE, this->tree.symbols->intern("translation_unit"), this->position(node), NO_NODE);
+            this->tree.nodes[sg_node]._type = this->tree.symbols->intern("root");
+            this->stack.push_back(sg_node);
+        }
+        else if (kind == SK_STRUCT_SPECIFIER || kind == SK_ENUM_SPECIFIER)
+        {
+            auto name_node = this->field(node, "name");
+            auto has_name = !ts_node_is_null(name_node);
+            auto kind = has_name ? StackGraphNodeKind::NAMED_SCOPE : StackGraphNodeKind::UNNAMED_SCOPE;
+            auto name_text = has_name ? this->text(name_node) : "";
+            auto name_id = this->tree.symbols->intern(name_text);
+
+            auto struct_node = this->tree.add(kind, name_id, this->position(node), this->stack.back());
+            this->tree.nodes[struct_node]._type = name_id;
+            if (has_name)
+            {
+                this->tree.nodes[struct_node].location = this->position(name_node);
+            }
+            this->stack.push_back(struct_node);
+            if (has_name && !ts_node_is_null(this->field(node, "body")))
+            {
+                this->types.define(this->tree, this->stack.size() - 2, struct_node);
+            }
+
+            if (ctx.state == STATE_POPULATE_TYPE)
+            {
+                ctx.jump_to = struct_node;
+            }
+            ctx.type = string(name_text);
+            frame.rule = RULE_STRUCT;
+        }
+        else if (kind == SK_FUNCTION_DEFINITION)
+        {
+            auto function_node = this->tree.add(StackGraphNodeKind::NAMED_SCOPE, stack_graph::EMPTY_SYMBOL, this->position(node), this->stack.back());
+            this->types.define(this->tree, this->stack.size() - 1, function_node);
+            this->stack.push_back(function_node);
+            frame.rule = RULE_FUNCTION_DEFINITION;
+            frame.own_ctx = this->newContext(STATE_FUNCTION_DEFINITION);
+        }
+        else if (kind == SK_PREPROC_INCLUDE)
+        {
+            auto text = this->text(this->field(node, "path"));
+            text = text.substr(1, text.size() - 2);
+            this->tree.add(StackGraphNodeKind::IMPORT, this->tree.symbols->intern(text), this->position(node), this->stack.back());
+            return;
+        }
+        else if (kind == SK_IDENTIFIER && ctx.state == STATE_REFERENCE)
+        {
+            ctx.type = string(this->text(node));
+            return;
+        }
+        else if (kind == SK_CALL_EXPRESSION && ctx.state == STATE_REFERENCE)
+        {
+            frame.rule = RULE_REFERENCE_ARGUMENT;
+            frame.node = this->field(node, "function");
+        }
+        else if ((kind == SK_POINTER_EXPRESSION || kind == SK_SUBSCRIPT_EXPRESSION) && ctx.state == STATE_REFERENCE)
+        {
+            frame.rule = RULE_REFERENCE_ARGUMENT;
+            frame.node = this->field(node, "argument");
+        }
+        else if (kind == SK_FIELD_EXPRESSION && ctx.state == STATE_REFERENCE)
+        {
+            frame.rule = RULE_REFERENCE_FIELD;
+        }
+        else if (_is_reference_kind(kind))
+        {
+            frame.rule = RULE_REFERENCE;
+            frame.own_ctx = this->newContext(STATE_REFERENCE);
+        }
+
+        if (ts_node_is_null(frame.node))
+        {
+            return;
+        }
+        this->frames.push_back(frame);
+    }
+
+    // Visits `node` next if it exists; returns false when there is nothing to visit.
+    bool visit(TSNode node, size_t ctx_id)
+    {
+        if (ts_node_is_null(node))
+        {
+            return false;
+        }
+        this->enter(node, ctx_id);
+        return true;
+    }
+
+    void leave()
+    {
+        auto &frame = this->frames.back();
+        if (frame.own_ctx != SIZE_MAX)
+        {
+            this->contexts.pop_back();
+        }
+        this->frames.pop_back();
+    }
+
+    // Advances the innermost frame by one step: either enters one child or
+    // finishes the frame.
+    void step()
+    {
+        auto depth = this->frames.size() - 1;
+        auto frame = this->frames[depth];
+        auto step = this->frames[depth].step++;
+        TSNode child;
+
+        switch (frame.rule)
+        {
+        case RULE_CHILDREN:
+        case RULE_COMPOUND:
+            if (this->nextChild(depth, child))
+            {
+                this->enter(child, frame.ctx);
+                return;
+            }
+            if (frame.pushed)
+            {
+                this->types.leave(this->stack.size() - 1);
+                this->stack.pop_back();
+            }
+            break;
+
+        case RULE_FUNCTION_DECLARATOR:
+            if (step == 0 && this->visit(this->field(frame.node, "declarator"), frame.own_ctx))
+                return;
+            if (step <= 1 && this->visit(this->field(frame.node, "parameters"), frame.ctx))
+            {
+                this->frames[depth].step = 2;
+                return;
+            }
+            break;
+
+        case RULE_DECLARATION:
+            if (step == 0)
+            {
+                if (this->visit(this->field(frame.node, "type"), frame.own_ctx))
+                    return;
+            }
+            if (step <= 1)
+            {
+                auto &ctx = this->contexts[frame.own_ctx];
+                if (ctx.jump_to == NO_NODE)
+                {
+                    ctx.jump_to = this->types.find(this->tree, this->stack, ctx.type);
+                }
+                this->frames[depth].step = 2;
+            }
+            // Declarators sit at the odd child positions.
+            while (this->nextChild(depth, child))
+            {
+                if (this->frames[depth].index % 2 == 0)
+                {
+                    this->contexts[frame.own_ctx].state = STATE_DECLARATION;
+                    this->enter(child, frame.own_ctx);
+                    return;
+                }
+            }
+            break;
+
+        case RULE_STRUCT:
+            if (step == 0)
+            {
+                if (this->visit(this->field(frame.node, "body"), frame.ctx))
+                    return;
+
+                this->tree.nodes[this->stack.back()].kind = StackGraphNodeKind::SYMBOL;
+                auto name_node = this->field(frame.node, "name");
+                auto type_node = this->types.find(this->tree, this->stack, ts_node_is_null(name_node) ? "" : this->text(name_node));
+                this->tree.nodes[this->stack.back()].jump_to = type_node == NO_NODE ? NodeRef() : NodeRef(&this->tree, type_node);
+            }
+            this->types.leave(this->stack.size() - 1);
+            this->stack.pop_back();
+            break;
+
+        case RULE_FUNCTION_DEFINITION:
+            if (step == 0 && this->visit(this->field(frame.node, "declarator"), frame.own_ctx))
+                return;
+            if (step <= 1)
+            {
+                this->contexts[frame.own_ctx].state = STATE_SKIP_COMPOUND;
+                this->frames[depth].step = 2;
+                if (this->visit(this->field(frame.node, "body"), frame.own_ctx))
+                    return;
+            }
+            this->types.leave(this->stack.size() - 1);
+            this->stack.pop_back();
+            break;
+
+        case RULE_REFERENCE_FIELD:
+            if (step == 0 && this->visit(this->field(frame.node, "argument"), frame.ctx))
+                return;
+            {
+                auto &ctx = this->contexts[frame.ctx];
+                ctx.type = ctx.type + "." + string(this->text(this->field(frame.node, "field")));
+            }
+            break;
+
+        case RULE_REFERENCE:
+            if (step == 0)
+            {
+                // The same node is visited again in reference state, which
+                // collects the dotted reference text into the new context.
+                this->enter(frame.node, frame.own_ctx);
+                return;
+            }
+            this->tree.add(StackGraphNodeKind::REFERENCE, this->tree.symbols->intern(this->contexts[frame.own_ctx].type), this->position(frame.node), this->stack.back());
+            break;
+
+        case RULE_REFERENCE_ARGUMENT:
+            // frame.node already is the function or argument child.
+            if (step == 0)
+            {
+                this->enter(frame.node, frame.ctx);
+                return;
+            }
+            break;
+        }
+
+        this->leave();
+    }
+
+    void build(TSNode root)
+    {
+        this->contexts.emplace_back();
+        this->enter(root, 0);
+        while (!this->frames.empty())
+        {
+            this->step();
+        }
+    }
+};
+
+shared_ptr<StackGraphTree> stack_graph::build_stack_graph_tree(TSNode root, std::string_view source_code, StringInterner &symbols, StackGraphBuilder builder)
+{
+
+    auto tree = std::make_shared<StackGraphTree>(&symbols);
+    auto &kinds = _syntax_kinds(ts_tree_language(root.tree));
+    vector<NodeId> stack;
+    if (builder == StackGraphBuilder::CURSOR_BUILDER)
+    {
+        _CursorBuilder(*tree, stack, source_code, kinds).build(root);
+    }
+    else
+    {
+        _Context context;
+        _TypeScopes types;
+        build_stack_graph(*tree, stack, types, source_code, kinds, root, context);
+    }
+    if (stack.size() == 0)
+    {
+        return nullptr;
+    }
+
+    tree->nodes.shrink_to_fit();
+    return tree;
+}
@@ -0,0 +1,83 @@
+#include <string-interner.h>
+
+using stack_graph::InternerStats;
+using stack_graph::StringInterner;
+using stack_graph::SymbolId;
+
+StringInterner::StringInterner() : chunks(new std::atomic<string *>[MAX_CHUNKS])
+{
+    for (size_t i = 0; i < MAX_CHUNKS; i++)
+    {
+        this->chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+    this->intern("");
+}
+
+StringInterner::~StringInterner()
+{
+    for (size_t i = 0; i < MAX_CHUNKS; i++)
+    {
+        delete[] this->chunks[i].load();
+    }
+}
+
+SymbolId StringInterner::intern(std::string_view text)
+{
+    auto &shard = this->shards[std::hash<std::string_view>{}(text) % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    shard.lookups++;
+    auto found = shard.ids.find(text);
+    if (found != shard.ids.end())
+    {
+        shard.hits++;
+        return found->second;
+    }
+
+    SymbolId id;
+    string *slot;
+    {
+        std::lock_guard<std::mutex> append_lock(this->append_mutex);
+        id = this->count.load(std::memory_order_relaxed);
+
+        auto chunk = this->chunks[id >> CHUNK_BITS].load(std::memory_order_relaxed);
+        if (chunk == nullptr)
+        {
+            chunk = new string[1 << CHUNK_BITS];
+            this->chunks[id >> CHUNK_BITS].store(chunk, std::memory_order_release);
+        }
+        slot = &chunk[id & ((1 << CHUNK_BITS) - 1)];
+        *slot = string(text);
+        this->bytes += slot->capacity() > 15 ? slot->capacity() + 1 : 0;
+        this->count.store(id + 1, std::memory_order_release);
+    }
+
+    shard.ids.emplace(std::string_view(*slot), id);
+    return id;
+}
+
+SymbolId StringInterner::find(std::string_view text)
+{
+    auto &shard = this->shards[std::hash<std::string_view>{}(text) % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = shard.ids.find(text);
+    return found == shard.ids.end() ? NO_SYMBOL : found->second;
+}
+
+InternerStats StringInterner::stats()
+{
+    InternerStats s = {0, 0, 0, 0};
+    for (auto &shard : this->shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        s.lookups += shard.lookups;
+        s.hits += shard.hits;
+        s.bytes += shard.ids.size() * (sizeof(std::string_view) + sizeof(SymbolId) + 2 * sizeof(void *)) + shard.ids.bucket_count() * sizeof(void *);
+    }
+
+    std::lock_guard<std::mutex> append_lock(this->append_mutex);
+    s.size = this->count.load();
+    s.bytes += this->bytes + ((s.size >> CHUNK_BITS) + 1) * (sizeof(string) << CHUNK_BITS) + MAX_CHUNKS * sizeof(void *);
+    return s;
+}
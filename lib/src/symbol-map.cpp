@@ -0,0 +1,212 @@
+#include <symbol-map.h>
+
+using stack_graph::NodeRef;
+using stack_graph::SymbolId;
+using stack_graph::SymbolMap;
+
+// Five bits of the symbol id per level, lowest first.
+const int _LEVEL_BITS = 5;
+
+static uint32_t _bit(SymbolId key, int shift)
+{
+    return 1u << ((key >> shift) & ((1u << _LEVEL_BITS) - 1));
+}
+
+static size_t _index(uint32_t bitmap, uint32_t bit)
+{
+    return __builtin_popcount(bitmap & (bit - 1));
+}
+
+static size_t _size(const SymbolMap::Slot &slot)
+{
+    return slot.child ? slot.child->size : 1;
+}
+
+// Copies `node` unless this is the only map holding it.
+static void _own(shared_ptr<SymbolMap::Node> &node)
+{
+    if (node.use_count() > 1)
+    {
+        node = std::make_shared<SymbolMap::Node>(*node);
+    }
+}
+
+static const NodeRef *_find(const SymbolMap::Node *node, SymbolId key, int shift)
+{
+    while (node != nullptr)
+    {
+        auto bit = _bit(key, shift);
+        if (!(node->bitmap & bit))
+        {
+            return nullptr;
+        }
+        auto &slot = node->slots[_index(node->bitmap, bit)];
+        if (!slot.child)
+        {
+            return slot.key == key ? &slot.value : nullptr;
+        }
+        node = slot.child.get();
+        shift += _LEVEL_BITS;
+    }
+    return nullptr;
+}
+
+// Sets `key` below `node`, which must not hold it unless `replace` is set.
+// Returns whether an entry was added.
+static bool _set(shared_ptr<SymbolMap::Node> &node, SymbolId key, NodeRef value, int shift)
+{
+    _own(node);
+    auto bit = _bit(key, shift);
+    auto index = _index(node->bitmap, bit);
+    if (!(node->bitmap & bit))
+    {
+        node->bitmap |= bit;
+        node->slots.insert(node->slots.begin() + index, {key, value, nullptr});
+        node->size++;
+        return true;
+    }
+
+    auto &slot = node->slots[index];
+    if (slot.child)
+    {
+        bool added = _set(slot.child, key, value, shift + _LEVEL_BITS);
+        node->size += added;
+        return added;
+    }
+    if (slot.key == key)
+    {
+        slot.value = value;
+        return false;
+    }
+
+    // Two keys share the slot: push both a level down, where they differ
+    // sooner or later.
+    auto child = std::make_shared<SymbolMap::Node>();
+    _set(child, slot.key, slot.value, shift + _LEVEL_BITS);
+    _set(child, key, value, shift + _LEVEL_BITS);
+    slot.child = std::move(child);
+    node->size++;
+    return true;
+}
+
+// Adds the entries of `from` missing below `into` and returns their number.
+// Subtries only one side has are shared, not copied.
+static size_t _merge(shared_ptr<SymbolMap::Node> &into, const shared_ptr<SymbolMap::Node> &from, int shift)
+{
+    if (into == from)
+    {
+        return 0;
+    }
+    _own(into);
+
+    size_t added = 0;
+    size_t i = 0;
+    for (uint32_t bits = from->bitmap; bits != 0; bits &= bits - 1, i++)
+    {
+        uint32_t bit = bits & -bits;
+        auto &theirs = from->slots[i];
+        auto index = _index(into->bitmap, bit);
+        if (!(into->bitmap & bit))
+        {
+            into->bitmap |= bit;
+            into->slots.insert(into->slots.begin() + index, theirs);
+            added += _size(theirs);
+            continue;
+        }
+
+        auto &ours = into->slots[index];
+        if (ours.child && theirs.child)
+        {
+            added += _merge(ours.child, theirs.child, shift + _LEVEL_BITS);
+        }
+        else if (ours.child)
+        {
+            if (_find(ours.child.get(), theirs.key, shift + _LEVEL_BITS) == nullptr)
+            {
+                added += _set(ours.child, theirs.key, theirs.value, shift + _LEVEL_BITS);
+            }
+        }
+        else if (theirs.child)
+        {
+            // Our entry wins, so it goes in first.
+            auto child = std::make_shared<SymbolMap::Node>();
+            _set(child, ours.key, ours.value, shift + _LEVEL_BITS);
+            added += _merge(child, theirs.child, shift + _LEVEL_BITS);
+            ours.child = std::move(child);
+        }
+        else if (ours.key != theirs.key)
+        {
+            auto child = std::make_shared<SymbolMap::Node>();
+            _set(child, ours.key, ours.value, shift + _LEVEL_BITS);
+            _set(child, theirs.key, theirs.value, shift + _LEVEL_BITS);
+            ours.child = std::move(child);
+            added++;
+        }
+    }
+    into->size += added;
+    return added;
+}
+
+static void _for_each(const SymbolMap::Node &node, std::function<void(SymbolId, NodeRef)> &cbk)
+{
+    for (auto &slot : node.slots)
+    {
+        if (slot.child)
+        {
+            _for_each(*slot.child, cbk);
+        }
+        else
+        {
+            cbk(slot.key, slot.value);
+        }
+    }
+}
+
+bool SymbolMap::insert(SymbolId key, NodeRef value)
+{
+    if (this->find(key) != nullptr)
+    {
+        return false;
+    }
+    if (!this->root)
+    {
+        this->root = std::make_shared<Node>();
+    }
+    return _set(this->root, key, value, 0);
+}
+
+void SymbolMap::assign(SymbolId key, NodeRef value)
+{
+    if (!this->root)
+    {
+        this->root = std::make_shared<Node>();
+    }
+    _set(this->root, key, value, 0);
+}
+
+void SymbolMap::merge(const SymbolMap &other)
+{
+    if (!other.root)
+    {
+        return;
+    }
+    if (!this->root)
+    {
+        this->root = other.root;
+        return;
+    }
+    _merge(this->root, other.root, 0);
+}
+
+const NodeRef *SymbolMap::find(SymbolId key) const
+{
+    return _find(this->root.get(), key, 0);
+}
+
+void SymbolMap::forEach(std::function<void(SymbolId, NodeRef)> cbk) const
+{
+    if (this->root)
+    {
+        _for_each(*this->root, cbk);
+    }
+}
@@ -0,0 +1,108 @@
+#include <usage-index.h>
+
+using stack_graph::NodeRef;
+using stack_graph::UsageIndex;
+
+void UsageIndex::_add(NodeRef node, NodeRef target)
+{
+    auto &nodes = this->usages[target];
+    node->usage_slot = nodes.size();
+    nodes.push_back(node);
+    this->count++;
+}
+
+void UsageIndex::_remove(NodeRef node, NodeRef target)
+{
+    auto found = this->usages.find(target);
+    if (found == this->usages.end())
+    {
+        return;
+    }
+
+    auto &nodes = found->second;
+    auto slot = node->usage_slot;
+    if (slot >= nodes.size() || nodes[slot] != node)
+    {
+        return;
+    }
+    nodes[slot] = nodes.back();
+    nodes[slot]->usage_slot = slot;
+    nodes.pop_back();
+    this->count--;
+    if (nodes.empty())
+    {
+        this->usages.erase(found);
+    }
+}
+
+void UsageIndex::jump(NodeRef node, NodeRef target)
+{
+    if (node->jump_to != nullptr)
+    {
+        this->_remove(node, node->jump_to);
+    }
+    node->jump_to = target;
+    this->jumps++;
+    if (target != nullptr)
+    {
+        this->_add(node, target);
+    }
+}
+
+void UsageIndex::insert(StackGraphTree &tree)
+{
+    for (NodeId id = 0; id < tree.nodes.size(); id++)
+    {
+        if (tree.nodes[id].jump_to != nullptr)
+        {
+            this->_add(NodeRef(&tree, id), tree.nodes[id].jump_to);
+        }
+    }
+}
+
+void UsageIndex::erase(StackGraphTree &tree)
+{
+    for (NodeId id = 0; id < tree.nodes.size(); id++)
+    {
+        if (tree.nodes[id].jump_to != nullptr)
+        {
+            this->_remove(NodeRef(&tree, id), tree.nodes[id].jump_to);
+        }
+    }
+
+    // Links into the tree are normally undone before it goes, but nothing
+    // may be left pointing at freed nodes.
+    for (NodeId id = 0; id < tree.nodes.size() && !this->usages.empty(); id++)
+    {
+        auto found = this->usages.find(NodeRef(&tree, id));
+        if (found != this->usages.end())
+        {
+            this->count -= found->second.size();
+            this->usages.erase(found);
+        }
+    }
+}
+
+const std::vector<NodeRef> &UsageIndex::find(NodeRef target) const
+{
+    static const std::vector<NodeRef> none;
+    auto found = this->usages.find(target);
+    return found == this->usages.end() ? none : found->second;
+}
+
+void UsageIndex::clear()
+{
+    this->usages.clear();
+    this->count = 0;
+}
+
+size_t UsageIndex::memoryUsage() const
+{
+    // Buckets plus one hash node per target.
+    size_t bytes = this->usages.bucket_count() * sizeof(void *);
+    for (auto &entry : this->usages)
+    {
+        bytes += sizeof(entry) + sizeof(void *) + entry.second.capacity() * sizeof(NodeRef);
+    }
+    return bytes;
+}
@@ -0,0 +1,232 @@
+#include <workspace-discovery.h>
+#include <set>
+#include <thread>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+
+using stack_graph::DiscoveredFile;
+using stack_graph::FileStream;
+using stack_graph::PathFilter;
+
+void FileStream::push(DiscoveredFile file)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->queue.push_back(std::move(file));
+    }
+    this->cv.notify_one();
+}
+
+void FileStream::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->closed = true;
+    }
+    this->cv.notify_all();
+}
+
+bool FileStream::pop(DiscoveredFile &file)
+{
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [this]()
+                  { return !this->queue.empty() || this->closed; });
+
+    if (this->queue.empty())
+    {
+        return false;
+    }
+
+    file = std::move(this->queue.front());
+    this->queue.pop_front();
+    return true;
+}
+
+struct _linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct _DirectoryQueue
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    vector<string> pending;
+    size_t in_progress = 0;
+    std::set<std::pair<dev_t, ino_t>> visited;
+
+    void push(string dir)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->pending.push_back(std::move(dir));
+        }
+        this->cv.notify_one();
+    }
+
+    // Blocks until there is a directory to crawl, or returns false once every
+    // worker is idle and nothing is left.
+    bool pop(string &dir)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->cv.wait(lock, [this]()
+                      { return !this->pending.empty() || this->in_progress == 0; });
+
+        if (this->pending.empty())
+        {
+            return false;
+        }
+
+        dir = std::move(this->pending.back());
+        this->pending.pop_back();
+        this->in_progress++;
+        return true;
+    }
+
+    void done()
+    {
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->in_progress--;
+            finished = this->in_progress == 0 && this->pending.empty();
+        }
+        if (finished)
+        {
+            this->cv.notify_all();
+        }
+    }
+
+    bool markVisited(dev_t device, ino_t inode)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->visited.insert({device, inode}).second;
+    }
+};
+
+static void _crawl_directory(const string &dir, const PathFilter &filter, bool follow_symlinks, _DirectoryQueue &dirs, FileStream &out)
+{
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat dir_st;
+    if (fstat(fd, &dir_st) != 0 || !dirs.markVisited(dir_st.st_dev, dir_st.st_ino))
+    {
+        close(fd);
+        return;
+    }
+
+    alignas(_linux_dirent64) char buffer[32768];
+    while (true)
+    {
+        long n = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        if (n <= 0)
+        {
+            break;
+        }
+
+        for (long offset = 0; offset < n;)
+        {
+            auto entry = reinterpret_cast<_linux_dirent64 *>(buffer + offset);
+            offset += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+
+            unsigned char type = entry->d_type;
+            dev_t device = dir_st.st_dev;
+            ino_t inode = entry->d_ino;
+
+            if (type == DT_UNKNOWN || type == DT_LNK)
+            {
+                struct stat st;
+                if (fstatat(fd, name, &st, type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
+                {
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode))
+                {
+                    if (type == DT_LNK && !follow_symlinks)
+                    {
+                        continue;
+                    }
+                    type = DT_DIR;
+                }
+                else if (S_ISREG(st.st_mode))
+                {
+                    type = DT_REG;
+                }
+                device = st.st_dev;
+                inode = st.st_ino;
+            }
+
+            string path = dir.back() == '/' ? dir + name : dir + "/" + name;
+
+            if (type == DT_DIR)
+            {
+                // Excludes are unanchored, so a directory whose path already
+                // matches one would have every file below it excluded too.
+                if (!filter.isExcluded(path + "/"))
+                {
+                    dirs.push(std::move(path));
+                }
+            }
+            else if (type == DT_REG && stack_graph::isSourceFileName(name) && !filter.isExcluded(path))
+            {
+                out.push({std::move(path), device, inode});
+            }
+        }
+    }
+
+    close(fd);
+}
+
+void stack_graph::discoverSourceFiles(const string &root, const PathFilter &filter, unsigned int threads, bool follow_symlinks, FileStream &out)
+{
+    _DirectoryQueue dirs;
+
+    string start = root;
+    while (start.size() > 1 && start.back() == '/')
+    {
+        start.pop_back();
+    }
+    dirs.push(start);
+
+    auto worker = [&]()
+    {
+        string dir;
+        while (dirs.pop(dir))
+        {
+            _crawl_directory(dir, filter, follow_symlinks, dirs, out);
+            dirs.done();
+        }
+    };
+
+    vector<std::thread> workers;
+    for (unsigned int t = 1; t < threads; t++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+
+    for (auto &w : workers)
+    {
+        w.join();
+    }
+
+    out.close();
+}
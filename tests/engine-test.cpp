@@ -3,8 +3,14 @@
 #include <gtest/gtest.h>
 #include <stack-graph-tree.h>
 #include <stack-graph-engine.h>
+#include <file-watcher.h>
 #include <vector>
 #include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <algorithm>
+#include <chrono>
 
 using stack_graph::StackGraphNode;
 using stack_graph::StackGraphEngine;
@@ -23,6 +29,38 @@ TEST(StackGraphEngine, ScansDirectory)
   ASSERT_EQ(4, engine.translation_units.size());
 }
 
+TEST(StackGraphEngine, SkipsExcludedPaths)
+{
+  auto path = "/home/dominik/Code/intellisense/c-language-server/corpus";
+  StackGraphEngine engine;
+
+  engine.loadDirectoryRecursive(path, {"/sample2/", "[invalid"});
+
+  ASSERT_EQ(2, engine.translation_units.size());
+}
+
+TEST(StackGraphEngine, DiscoveryHandlesLinksAndPrunes)
+{
+  namespace fs = std::filesystem;
+  auto root = fs::temp_directory_path() / "c-language-server-discovery";
+  fs::remove_all(root);
+  fs::create_directories(root / "a");
+  fs::create_directories(root / "b");
+  fs::create_directories(root / "excluded");
+  std::ofstream(root / "a" / "x.c") << "struct A { int b; };";
+  std::ofstream(root / "excluded" / "z.c") << "struct Z { int b; };";
+  fs::create_directory_symlink(root, root / "a" / "loop");
+  fs::create_symlink(root / "a" / "x.c", root / "b" / "y.h");
+
+  StackGraphEngine engine;
+  engine.loadDirectoryRecursive(root.string(), {"/excluded/"}, 4, true);
+
+  ASSERT_EQ(1, engine.translation_units.size());
+  ASSERT_EQ(1, engine.translation_units.count((root / "a" / "x.c").string()));
+
+  fs::remove_all(root);
+}
+
 TEST(StackGraphEngine, FindsImportsForTU)
 {
   auto path = "/home/dominik/Code/intellisense/c-language-server/corpus/sample2";
@@ -42,7 +80,7 @@ TEST(StackGraphEngine, FindsExportedDefinitions)
 
   auto defs = engine.exportedDefinitionsForTranslationUnit("/home/dominik/Code/intellisense/c-language-server/corpus/sample2/def2.h");
 
-  ASSERT_EQ("Organization", defs[0]->symbol);
+  ASSERT_EQ("Organization", defs[0].symbolText());
 }
 
 TEST(StackGraphEngine, FindsSymbolsInTU)
@@ -112,6 +150,845 @@ TEST(StackGraphEngine, ResolvesSymbolUsages)
   ASSERT_EQ(1, results.size());
 }
 
+TEST(StackGraphEngine, FindsFieldUsagesInAnySegment)
+{
+  auto dir = string("/home/dominik/Code/intellisense/c-language-server/corpus/sample2");
+  auto main_c = dir + "/main.c";
+  StackGraphEngine engine;
+  engine.crossLink(engine.loadDirectoryRecursive(dir, {}));
+
+  // org.emp.name and org2.emp.name name `emp` in their middle segment.
+  auto emp = engine.findUsages(Coordinate(dir + "/def2.h", 7, 20));
+  ASSERT_EQ(2, emp.size());
+  ASSERT_EQ(Coordinate(main_c, 10, 4), *emp[0]);
+  ASSERT_EQ(Coordinate(main_c, 11, 4), *emp[1]);
+  ASSERT_EQ(2, engine.findUsages(Coordinate(dir + "/def1.h", 3, 11)).size());
+
+  auto references = engine.references.size();
+  ASSERT_TRUE(engine.openDocument(main_c, "void f(struct Organization o) {\n    o.emp.emp = 0;\n}\n"));
+  emp = engine.findUsages(Coordinate(dir + "/def2.h", 7, 20));
+  ASSERT_EQ(1, emp.size());
+  ASSERT_EQ(Coordinate(main_c, 1, 4), *emp[0]);
+  ASSERT_EQ(0, engine.findUsages(Coordinate(dir + "/def1.h", 3, 11)).size());
+
+  ASSERT_TRUE(engine.closeDocument(main_c));
+  ASSERT_EQ(2, engine.findUsages(Coordinate(dir + "/def2.h", 7, 20)).size());
+  ASSERT_EQ(references, engine.references.size());
+  ASSERT_GT(engine.stats().reference_index_bytes, 0);
+}
+
+TEST(StackGraphEngine, ParallelScanMatchesSerial)
+{
+  auto path = "/home/dominik/Code/intellisense/c-language-server/corpus";
+  StackGraphEngine serial;
+  StackGraphEngine parallel;
+
+  serial.loadDirectoryRecursive(path, {});
+  parallel.loadDirectoryRecursive(path, {}, 4);
+
+  ASSERT_EQ(serial.translation_units.size(), parallel.translation_units.size());
+  ASSERT_EQ(serial.node_table.size(), parallel.node_table.size());
+  ASSERT_TRUE(std::equal(serial.name_to_path.begin(), serial.name_to_path.end(), parallel.name_to_path.begin()));
+
+  for (auto &entry : serial.translation_units)
+  {
+    ASSERT_EQ(entry.second->repr(), parallel.translation_units.at(entry.first)->repr());
+  }
+}
+
+TEST(StackGraphEngine, ParallelCrossLinkMatchesSerial)
+{
+  namespace fs = std::filesystem;
+  auto root = fs::temp_directory_path() / "c-language-server-parallel-link";
+  fs::remove_all(root);
+  fs::create_directories(root);
+
+  // a.h and b.h include each other.
+  std::ofstream(root / "types.h") << "struct T { int x; };";
+  std::ofstream(root / "a.h") << "#include <types.h>\n#include <b.h>\nstruct A { struct T t; struct B *b; };";
+  std::ofstream(root / "b.h") << "#include <a.h>\nstruct B { struct A *a; struct T t; };";
+  for (int i = 0; i < 8; i++)
+  {
+    std::ofstream(root / ("c" + std::to_string(i) + ".c")) << "#include <" << (i % 2 ? "a.h" : "b.h") << ">\nstruct A a; struct B b; struct T t;";
+  }
+
+  auto links = [](StackGraphEngine &engine)
+  {
+    vector<string> lst;
+    for (auto &link : engine.cross_links)
+    {
+      lst.push_back(link.repr());
+    }
+    return lst;
+  };
+
+  StackGraphEngine serial;
+  StackGraphEngine parallel;
+  serial.crossLink(serial.loadDirectoryRecursive(root.string(), {}));
+  parallel.crossLink(parallel.loadDirectoryRecursive(root.string(), {}), 4);
+
+  ASSERT_EQ(18, serial.cross_links.size());
+  ASSERT_EQ(links(serial), links(parallel));
+  ASSERT_EQ(serial.usages.size(), parallel.usages.size());
+  for (auto &entry : serial.translation_units)
+  {
+    ASSERT_EQ(entry.second->repr(), parallel.translation_units.at(entry.first)->repr());
+  }
+
+  serial.crossLink();
+  parallel.crossLink(0);
+  ASSERT_EQ(links(serial), links(parallel));
+
+  // A unit entering the cycle from the other side sees it broken the way a
+  // full link breaks it.
+  std::ofstream(root / "d.c") << "#include <a.h>\nstruct A a; struct B b;";
+  ASSERT_EQ(1, serial.crossLink(serial.loadDirectoryRecursive(root.string(), {})));
+  auto incremental = links(serial);
+  serial.crossLink();
+  auto full = links(serial);
+  std::sort(incremental.begin(), incremental.end());
+  std::sort(full.begin(), full.end());
+  ASSERT_EQ(full, incremental);
+
+  fs::remove_all(root);
+}
+
+TEST(StackGraphEngine, ReusesParsers)
+{
+  auto path = "/home/dominik/Code/intellisense/c-language-server/corpus";
+  StackGraphEngine serial;
+  StackGraphEngine parallel;
+
+  serial.loadDirectoryRecursive(path, {});
+  parallel.loadDirectoryRecursive(path, {}, 4);
+
+  ASSERT_EQ(1, serial.stats().parsers_created);
+  ASSERT_GE(4, parallel.stats().parsers_created);
+}
+
+TEST(StackGraphEngine, LoadsSourcesWithoutCopying)
+{
+  namespace fs = std::filesystem;
+  auto root = fs::temp_directory_path() / "c-language-server-no-copy";
+  fs::remove_all(root);
+  fs::create_directories(root);
+
+  // Small files are read, large ones mapped.
+  std::ofstream(root / "small.c") << "int small;\n";
+  {
+    std::ofstream large(root / "large.c");
+    for (size_t i = 0; i * 8 < stack_graph::SOURCE_MAP_THRESHOLD; i++)
+    {
+      large << "int v" << i << ";\n";
+    }
+  }
+
+  StackGraphEngine engine;
+  engine.loadDirectoryRecursive(root.string(), {});
+
+  auto small = fs::file_size(root / "small.c");
+  ASSERT_EQ(small + fs::file_size(root / "large.c"), engine.stats().bytes_read);
+  ASSERT_EQ(small, engine.stats().bytes_copied);
+
+  fs::remove_all(root);
+}
+
+TEST(StackGraphEngine, InternsSymbols)
+{
+  auto path = "/home/dominik/Code/intellisense/c-language-server/corpus/sample2";
+  StackGraphEngine engine;
+
+  engine.loadDirectoryRecursive(path, {});
+
+  auto stats = engine.stats();
+  ASSERT_NE(stack_graph::NO_SYMBOL, engine.symbols.find("Organization"));
+  ASSERT_LT(stats.symbols.size, stats.nodes);
+  ASSERT_LT(0, stats.symbols.hits);
+}
+
+TEST(NodeTable, LooksUpAndReplacesFiles)
+{
+  auto path = "/home/dominik/Code/intellisense/c-language-server/corpus/sample2";
+  auto main_c = string(path) + "/main.c";
+  StackGraphEngine engine;
+  engine.loadDirectoryRecursive(path, {});
+
+  auto &table = engine.node_table;
+  auto total = table.size();
+  auto node = table.find(main_c, 10, 4);
+  ASSERT_TRUE(node != nullptr);
+  ASSERT_EQ("org.emp.name", node.symbolText());
+  ASSERT_TRUE(table.find(main_c, 10, 5) == nullptr);
+  ASSERT_TRUE(table.find(string(path) + "/missing.c", 10, 4) == nullptr);
+
+  auto tree = engine.translation_units.at(main_c);
+  table.erase(main_c);
+  ASSERT_TRUE(table.find(main_c, 10, 4) == nullptr);
+  ASSERT_LT(table.size(), total);
+
+  table.insert(main_c, *tree);
+  ASSERT_EQ(total, table.size());
+  ASSERT_TRUE(node == table.find(main_c, 10, 4));
+  ASSERT_EQ(4, table.files.size());
+
+  // The scope main and the reference to it share a position.
+  auto file = table.fileOf(tree.get());
+  auto reference = table.find(main_c, 5, 4);
+  ASSERT_EQ(stack_graph::StackGraphNodeKind::REFERENCE, reference->kind);
+  ASSERT_TRUE(table.visible(file, reference.id));
+  ASSERT_FALSE(table.visible(file, reference.parent().id));
+  ASSERT_EQ(table.file_ids.at(main_c), file);
+}
+
+TEST(SymbolMap, MergesWithoutChangingSharedCopies)
+{
+  auto def = [](uint32_t id)
+  { return stack_graph::NodeRef(nullptr, id); };
+
+  // Keys that agree in their low bits end up several levels down.
+  stack_graph::SymbolMap base;
+  for (uint32_t key : {1u, 33u, 1025u, 1u << 30, 7u})
+  {
+    ASSERT_TRUE(base.insert(key, def(key)));
+  }
+  ASSERT_FALSE(base.insert(33, def(0)));
+  ASSERT_EQ(5, base.size());
+
+  auto copy = base;
+  stack_graph::SymbolMap other;
+  other.insert(33, def(0));
+  other.insert(65, def(65));
+  other.insert(8, def(8));
+  copy.merge(other);
+  copy.assign(7, def(0));
+
+  ASSERT_EQ(7, copy.size());
+  ASSERT_EQ(33, copy.find(33)->id);
+  ASSERT_EQ(65, copy.find(65)->id);
+  ASSERT_EQ(0, copy.find(7)->id);
+  ASSERT_EQ(5, base.size());
+  ASSERT_EQ(7, base.find(7)->id);
+  ASSERT_TRUE(base.find(65) == nullptr);
+  ASSERT_EQ(1u << 30, base.find(1u << 30)->id);
+
+  size_t seen = 0;
+  copy.forEach([&](stack_graph::SymbolId key, stack_graph::NodeRef value)
+               {
+    ASSERT_EQ(copy.find(key)->id, value.id);
+    seen++; });
+  ASSERT_EQ(copy.size(), seen);
+
+  // Merging into an empty map shares the other one whole.
+  stack_graph::SymbolMap empty;
+  empty.merge(base);
+  ASSERT_EQ(base.root, empty.root);
+  empty.merge(base);
+  ASSERT_EQ(5, empty.size());
+}
+
+TEST(StackGraphEngine, ResolutionTableMatchesWalk)
+{
+  auto dir = string("/home/dominik/Code/intellisense/c-language-server/corpus/sample2");
+  StackGraphEngine engine;
+  engine.crossLink(engine.loadDirectoryRecursive(dir, {}));
+
+  auto resolveEverything = [&]()
+  {
+    vector<string> lst;
+    for (auto &entry : engine.translation_units)
+    {
+      for (auto &node : entry.second->nodes)
+      {
+        if (node.kind == stack_graph::StackGraphNodeKind::REFERENCE || node.kind == stack_graph::StackGraphNodeKind::SYMBOL)
+        {
+          auto res = engine.resolve(Coordinate(entry.first, node.location.line, node.location.column));
+          lst.push_back(res == nullptr ? "-" : res->path + ":" + std::to_string(res->line) + ":" + std::to_string(res->column));
+        }
+      }
+    }
+    return lst;
+  };
+
+  auto walked = resolveEverything();
+  engine.resolveAll(2);
+  ASSERT_TRUE(engine._resolutionsValid());
+  ASSERT_EQ(walked.size(), engine.resolutions.references);
+  ASSERT_LT(0, engine.resolutions.resolved);
+  ASSERT_EQ(walked, resolveEverything());
+
+  // An edit changes links, so resolve walks again until the next pass.
+  ASSERT_TRUE(engine.openDocument(dir + "/main.c", "int x;\n"));
+  ASSERT_FALSE(engine._resolutionsValid());
+  ASSERT_TRUE(engine.closeDocument(dir + "/main.c"));
+  ASSERT_EQ(walked, resolveEverything());
+}
+
+TEST(StackGraphEngine, ResolveStaysBoundedOnAdversarialInput)
+{
+  namespace fs = std::filesystem;
+  auto root = fs::temp_directory_path() / "c-language-server-adversarial";
+  fs::remove_all(root);
+  fs::create_directories(root);
+
+  auto chain = [](const char *var, int depth, const char *member)
+  {
+    string text = var;
+    for (int i = 0; i < depth; i++)
+    {
+      text += string("->") + member;
+    }
+    return text + "->v";
+  };
+
+  // Self-referential structs, walked through up to 20000 members.
+  const vector<int> depths = {0, 1, 10, 100, 1000, 20000};
+  {
+    std::ofstream source(root / "adversarial.c");
+    source << "struct node { struct node *next; int v; };\nstruct ring { struct ring *peer; int v; };\nstruct node n;\nstruct ring r;\nint f(void)\n{\n";
+    for (auto depth : depths)
+    {
+      source << "    " << chain("n", depth, "next") << ";\n";
+      source << "    " << chain("r", depth, "peer") << ";\n";
+    }
+    source << "}\n";
+  }
+
+  StackGraphEngine engine;
+  engine.crossLink(engine.loadDirectoryRecursive(root.string(), {}));
+  auto path = (root / "adversarial.c").string();
+  auto &tree = *engine.translation_units.at(path);
+
+  // Point struct ring's member at itself, as a corrupt link would.
+  for (stack_graph::NodeId id = 0; id < tree.nodes.size(); id++)
+  {
+    if (tree.nodes[id].kind == stack_graph::StackGraphNodeKind::SYMBOL && engine.symbols.text(tree.nodes[id].symbol) == "peer")
+    {
+      engine.usages.jump(stack_graph::NodeRef(&tree, id), stack_graph::NodeRef(&tree, id));
+    }
+  }
+
+  auto at = [&](size_t i)
+  { return Coordinate(path, 6 + i, 4); };
+
+  stack_graph::ResolveBudget budget;
+  budget.steps = 4096;
+  stack_graph::ResolveStatus status;
+  for (size_t i = 0; i < depths.size(); i++)
+  {
+    auto resolved = engine.resolve(at(2 * i), budget, status);
+    ASSERT_EQ(depths[i] <= 1000 ? stack_graph::RESOLVE_OK : stack_graph::RESOLVE_BUDGET_EXCEEDED, status) << depths[i];
+    ASSERT_EQ(status == stack_graph::RESOLVE_OK, resolved != nullptr);
+
+    resolved = engine.resolve(at(2 * i + 1), budget, status);
+    ASSERT_EQ(depths[i] == 0 ? stack_graph::RESOLVE_OK : stack_graph::RESOLVE_CYCLE, status) << depths[i];
+  }
+
+  // Out of time: the clock is first read after a few dozen steps.
+  stack_graph::ResolveBudget no_time;
+  no_time.steps = SIZE_MAX;
+  no_time.time_us = 0;
+  ASSERT_TRUE(engine.resolve(at(2), no_time, status) != nullptr);
+  ASSERT_TRUE(engine.resolve(at(8), no_time, status) == nullptr);
+  ASSERT_EQ(stack_graph::RESOLVE_BUDGET_EXCEEDED, status);
+
+  // The table keeps why a node gave up.
+  engine.resolve_budget = budget;
+  engine.resolveAll();
+  engine.resolve(at(10), budget, status);
+  ASSERT_EQ(stack_graph::RESOLVE_BUDGET_EXCEEDED, status);
+  engine.resolve(at(3), budget, status);
+  ASSERT_EQ(stack_graph::RESOLVE_CYCLE, status);
+  engine.resolutions.clear();
+
+  // Every reference and symbol ends with a status within the step budget,
+  // and every adversarial chain gives up rather than resolving.
+  for (auto &node : tree.nodes)
+  {
+    if (node.kind != stack_graph::StackGraphNodeKind::REFERENCE && node.kind != stack_graph::StackGraphNodeKind::SYMBOL)
+    {
+      continue;
+    }
+    size_t steps = SIZE_MAX;
+    status = (stack_graph::ResolveStatus)-1;
+    auto start = std::chrono::steady_clock::now();
+    auto resolved = engine.resolve(Coordinate(path, node.location.line, node.location.column), budget, status, &steps);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    ASSERT_LE(steps, budget.steps);
+    // Far past the time budget would mean the clock is ignored; the slack
+    // absorbs a loaded machine.
+    ASSERT_LT(elapsed, 20 * budget.time_us);
+    ASSERT_STRNE("unknown", stack_graph::resolveStatusName(status));
+    ASSERT_EQ(status == stack_graph::RESOLVE_OK, resolved != nullptr);
+  }
+  for (size_t i = 1; i < depths.size(); i++)
+  {
+    size_t steps;
+    engine.resolve(at(2 * i + 1), budget, status, &steps);
+    ASSERT_EQ(stack_graph::RESOLVE_CYCLE, status);
+    ASSERT_LE(steps, budget.steps);
+  }
+  size_t steps;
+  engine.resolve(at(2 * depths.size() - 2), budget, status, &steps);
+  ASSERT_EQ(stack_graph::RESOLVE_BUDGET_EXCEEDED, status);
+  ASSERT_EQ(budget.steps, steps);
+
+  fs::remove_all(root);
+}
+
+TEST(IncludeGraph, ReportsIncludesBothWays)
+{
+  auto dir = string("/home/dominik/Code/intellisense/c-language-server/corpus/sample2");
+  StackGraphEngine engine;
+  engine.crossLink(engine.loadDirectoryRecursive(dir, {}));
+  ASSERT_EQ(3, engine.includes.edges);
+
+  auto sorted = [](vector<string> lst)
+  {
+    std::sort(lst.begin(), lst.end());
+    return lst;
+  };
+
+  auto def2 = engine.includeRelations(dir + "/def2.h");
+  ASSERT_TRUE(def2 != nullptr);
+  ASSERT_EQ(vector<string>({dir + "/def1.h"}), def2->includes);
+  ASSERT_EQ(vector<string>({dir + "/def1.h"}), def2->transitive_includes);
+  ASSERT_EQ(vector<string>({dir + "/def2.c", dir + "/main.c"}), sorted(def2->includers));
+
+  auto def1 = engine.includeRelations(dir + "/def1.h");
+  ASSERT_TRUE(def1->includes.empty());
+  ASSERT_EQ(vector<string>({dir + "/def2.h"}), def1->includers);
+  ASSERT_EQ(vector<string>({dir + "/def2.h"}), vector<string>(def1->transitive_includers.begin(), def1->transitive_includers.begin() + 1));
+  ASSERT_EQ(vector<string>({dir + "/def2.c", dir + "/def2.h", dir + "/main.c"}), sorted(def1->transitive_includers));
+  ASSERT_TRUE(engine.includeRelations(dir + "/missing.h") == nullptr);
+
+  // An include dropped in an open document leaves the graph.
+  ASSERT_TRUE(engine.openDocument(dir + "/main.c", "int x;\n"));
+  ASSERT_EQ(vector<string>({dir + "/def2.c"}), engine.includeRelations(dir + "/def2.h")->includers);
+  ASSERT_TRUE(engine.closeDocument(dir + "/main.c"));
+  ASSERT_EQ(2, engine.includeRelations(dir + "/def2.h")->includers.size());
+  ASSERT_EQ(vector<string>({"def2.h"}), engine.importsForTranslationUnit(dir + "/main.c"));
+}
+
+TEST(CompileDatabase, ResolvesIncludesWithEachCommandsSearchPath)
+{
+  namespace fs = std::filesystem;
+  auto root = fs::temp_directory_path() / "c-language-server-compile-commands";
+  fs::remove_all(root);
+  fs::create_directories(root / "a");
+  fs::create_directories(root / "b");
+  fs::create_directories(root / "app");
+
+  std::ofstream(root / "a" / "types.h") << "struct T { int a; };";
+  std::ofstream(root / "b" / "types.h") << "struct T { int b; };";
+  std::ofstream(root / "unit.c") << "#include <types.h>\nstruct T t;\n";
+  std::ofstream(root / "app" / "main.c") << "#include <types.h>\nstruct T t;\n";
+  std::ofstream(root / "other.c") << "#include <types.h>\nstruct T t;\n";
+  std::ofstream(root / "compile_commands.json")
+      << "[{\"directory\": \"" << root.string() << "\", \"file\": \"unit.c\", \"command\": \"cc -Ib -c unit.c\"},\n"
+      << " {\"directory\": \"" << (root / "app").string() << "\", \"file\": \"main.c\", \"arguments\": [\"cc\", \"-I\", \"../a\", \"-c\", \"main.c\"]}]";
+
+  StackGraphEngine engine;
+  ASSERT_FALSE(engine.useCompileCommands((root / "missing.json").string()));
+  ASSERT_TRUE(engine.useCompileCommands((root / "compile_commands.json").string()));
+  engine.crossLink(engine.loadDirectoryRecursive(root.string(), {}));
+
+  ASSERT_EQ(4, engine.translation_units.size());
+  ASSERT_EQ(0, engine.translation_units.count((root / "other.c").string()));
+  ASSERT_EQ(vector<string>({(root / "b" / "types.h").string()}), engine.includeRelations((root / "unit.c").string())->includes);
+  ASSERT_EQ(vector<string>({(root / "a" / "types.h").string()}), engine.includeRelations((root / "app" / "main.c").string())->includes);
+
+  auto unit = engine.resolve(Coordinate((root / "unit.c").string(), 1, 7));
+  ASSERT_TRUE(unit != nullptr);
+  ASSERT_EQ((root / "b" / "types.h").string(), unit->path);
+  auto main = engine.resolve(Coordinate((root / "app" / "main.c").string(), 1, 7));
+  ASSERT_TRUE(main != nullptr);
+  ASSERT_EQ((root / "a" / "types.h").string(), main->path);
+
+  // Without the database every file is indexed again and includes match by
+  // file name.
+  ASSERT_TRUE(engine.useCompileCommands(""));
+  engine.crossLink(engine.loadDirectoryRecursive(root.string(), {}));
+  ASSERT_EQ(5, engine.translation_units.size());
+  ASSERT_EQ((root / "a" / "types.h").string(), engine.resolve(Coordinate((root / "unit.c").string(), 1, 7))->path);
+
+  fs::remove_all(root);
+}
+
+TEST(StringInterner, InternsConcurrentlyToDenseIds)
+{
+  stack_graph::StringInterner symbols;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++)
+  {
+    threads.emplace_back([&]()
+                         {
+      for (int i = 0; i < 5000; i++)
+      {
+        symbols.intern("sym" + std::to_string(i));
+      } });
+  }
+  for (auto &t : threads)
+  {
+    t.join();
+  }
+
+  ASSERT_EQ(5001, symbols.size());
+  ASSERT_EQ(stack_graph::EMPTY_SYMBOL, symbols.intern(""));
+  ASSERT_EQ("sym4321", symbols.text(symbols.find("sym4321")));
+  ASSERT_EQ(stack_graph::NO_SYMBOL, symbols.find("sym5000"));
+}
+
+std::filesystem::path _copy_sample2(const char *name)
+{
+  namespace fs = std::filesystem;
+  auto root = fs::temp_directory_path() / name;
+  fs::remove_all(root);
+  fs::create_directories(root);
+  fs::copy("/home/dominik/Code/intellisense/c-language-server/corpus/sample2", root / "sample2", fs::copy_options::recursive);
+  return root;
+}
+
+TEST(StackGraphEngine, RestoresIndexSnapshot)
+{
+  auto root = _copy_sample2("c-language-server-snapshot");
+  auto snapshot = (root / "index.bin").string();
+  StackGraphEngine engine;
+  engine.loadDirectoryRecursive((root / "sample2").string(), {});
+  engine.crossLink();
+  ASSERT_TRUE(engine.saveIndex(snapshot, "sample2"));
+
+  StackGraphEngine loaded;
+  ASSERT_EQ(stack_graph::SNAPSHOT_LOADED, loaded.loadIndex(snapshot, "sample2"));
+
+  ASSERT_EQ(engine.node_table.size(), loaded.node_table.size());
+  ASSERT_EQ(engine.h_to_c, loaded.h_to_c);
+  ASSERT_TRUE(std::equal(engine.name_to_path.begin(), engine.name_to_path.end(), loaded.name_to_path.begin(), loaded.name_to_path.end()));
+  ASSERT_EQ(engine.cross_links.size(), loaded.cross_links.size());
+  for (size_t i = 0; i < engine.cross_links.size(); i++)
+  {
+    ASSERT_EQ(engine.cross_links[i].repr(), loaded.cross_links[i].repr());
+  }
+  for (auto &entry : engine.translation_units)
+  {
+    ASSERT_EQ(entry.second->repr(), loaded.translation_units.at(entry.first)->repr());
+  }
+
+  auto resolution = loaded.resolve(Coordinate((root / "sample2" / "main.c").string(), 10, 4));
+  ASSERT_EQ((root / "sample2" / "def1.h").string(), resolution->path);
+  ASSERT_EQ(4, loaded.findUsages(Coordinate((root / "sample2" / "def2.h").string(), 6, 7)).size());
+
+  // The snapshot only knows its own units; the scan after a load adds files
+  // created since and skips the rest.
+  auto extra = (root / "sample2" / "extra.c").string();
+  std::ofstream(extra) << "#include <def1.h>\n\nstruct Employee boss;\n";
+  StackGraphEngine rescanned;
+  ASSERT_EQ(stack_graph::SNAPSHOT_LOADED, rescanned.loadIndex(snapshot, "sample2"));
+  auto delta = rescanned.loadDirectoryRecursive((root / "sample2").string(), {});
+  ASSERT_EQ(1, delta.added);
+  ASSERT_EQ(engine.translation_units.size(), delta.skipped);
+  rescanned.crossLink(delta);
+  ASSERT_EQ(1, rescanned.translation_units.count(extra));
+
+  // Open documents are laid over the loaded units again.
+  auto main_c = (root / "sample2" / "main.c").string();
+  auto def1_h = (root / "sample2" / "def1.h").string();
+  std::ifstream in(main_c);
+  string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  StackGraphEngine editing;
+  ASSERT_TRUE(editing.openDocument(main_c, "\n\n" + text));
+  ASSERT_EQ(stack_graph::SNAPSHOT_LOADED, editing.loadIndex(snapshot, "sample2"));
+  ASSERT_EQ(nullptr, editing.resolve(Coordinate(main_c, 10, 4)));
+  ASSERT_EQ(def1_h, editing.resolve(Coordinate(main_c, 12, 4))->path);
+  ASSERT_TRUE(editing.documents.at(main_c).indexed);
+
+  // Files edited or removed since the save do not make the snapshot stale:
+  // it loads, and the scan after it reparses the edited file only.
+  std::ofstream(main_c, std::ios::app) << "\n";
+  std::filesystem::remove(root / "sample2" / "def2.c");
+  StackGraphEngine touched;
+  ASSERT_EQ(stack_graph::SNAPSHOT_LOADED, touched.loadIndex(snapshot, "sample2"));
+  delta = touched.loadDirectoryRecursive((root / "sample2").string(), {});
+  ASSERT_EQ(1, delta.reparsed);
+  ASSERT_EQ(1, delta.added);
+  ASSERT_EQ(1, delta.removed);
+  ASSERT_EQ(engine.translation_units.size() - 2, delta.skipped);
+  touched.crossLink(delta);
+  ASSERT_EQ(def1_h, touched.resolve(Coordinate(main_c, 10, 4))->path);
+
+  std::filesystem::remove_all(root);
+}
+
+TEST(StackGraphEngine, RejectsBadIndexSnapshots)
+{
+  namespace fs = std::filesystem;
+  auto root = _copy_sample2("c-language-server-bad-snapshot");
+  auto snapshot = (root / "index.bin").string();
+  StackGraphEngine engine;
+  engine.loadDirectoryRecursive((root / "sample2").string(), {});
+  engine.crossLink();
+  ASSERT_TRUE(engine.saveIndex(snapshot, "sample2"));
+
+  auto damaged = [&](const char *name, size_t offset, uint32_t value)
+  {
+    auto copy = (root / name).string();
+    fs::copy_file(snapshot, copy);
+    std::fstream f(copy, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(offset);
+    f.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    return copy;
+  };
+
+  StackGraphEngine other;
+  ASSERT_EQ(stack_graph::SNAPSHOT_MISSING, other.loadIndex((root / "missing.bin").string(), ""));
+  ASSERT_EQ(stack_graph::SNAPSHOT_STALE, other.loadIndex(snapshot, "elsewhere"));
+  ASSERT_EQ(stack_graph::SNAPSHOT_VERSION_MISMATCH, other.loadIndex(damaged("version.bin", 8, 999), ""));
+  // A bad unit is caught before any of the snapshot's symbols are interned.
+  auto symbols = other.symbols.size();
+  ASSERT_EQ(stack_graph::SNAPSHOT_CORRUPT, other.loadIndex(damaged("nodes.bin", fs::file_size(snapshot) - 8, 12345), ""));
+  ASSERT_EQ(symbols, other.symbols.size());
+  ASSERT_EQ(0, other.translation_units.size());
+
+  fs::remove_all(root);
+}
+
+TEST(StackGraphEngine, IndexesIncrementally)
+{
+  namespace fs = std::filesystem;
+  auto root = _copy_sample2("c-language-server-incremental");
+  auto dir = (root / "sample2").string();
+  StackGraphEngine engine;
+
+  auto delta = engine.loadDirectoryRecursive(dir, {});
+  ASSERT_EQ(4, delta.added);
+  ASSERT_EQ(4, engine.crossLink(delta));
+
+  delta = engine.loadDirectoryRecursive(dir, {});
+  ASSERT_EQ(4, delta.skipped);
+  ASSERT_EQ(0, engine.crossLink(delta));
+
+  // Touched only: the content hash keeps the tree.
+  fs::last_write_time(root / "sample2" / "main.c", fs::last_write_time(root / "sample2" / "main.c") + std::chrono::seconds(5));
+  delta = engine.loadDirectoryRecursive(dir, {});
+  ASSERT_EQ(4, delta.skipped);
+
+  std::ofstream((root / "sample2" / "def1.h").string()) << "\n\n\n\nstruct Employee {\n    string name;\n}";
+  fs::remove(root / "sample2" / "def2.c");
+  std::ofstream((root / "sample2" / "extra.c").string()) << "#include <def1.h>\n\nstruct Employee boss;\n";
+  delta = engine.loadDirectoryRecursive(dir, {});
+  ASSERT_EQ(2, delta.skipped);
+  ASSERT_EQ(1, delta.reparsed);
+  ASSERT_EQ(1, delta.added);
+  ASSERT_EQ(1, delta.removed);
+  ASSERT_EQ(4, engine.crossLink(delta));
+
+  StackGraphEngine fresh;
+  fresh.loadDirectoryRecursive(dir, {});
+  fresh.crossLink();
+
+  ASSERT_EQ(fresh.node_table.size(), engine.node_table.size());
+  ASSERT_EQ(fresh.cross_links.size(), engine.cross_links.size());
+  ASSERT_EQ(fresh.h_to_c, engine.h_to_c);
+  ASSERT_TRUE(std::equal(engine.name_to_path.begin(), engine.name_to_path.end(), fresh.name_to_path.begin(), fresh.name_to_path.end()));
+  for (auto &entry : fresh.translation_units)
+  {
+    ASSERT_EQ(entry.second->repr(), engine.translation_units.at(entry.first)->repr());
+  }
+  for (auto &file : fresh.node_table.files)
+  {
+    for (auto &entry : file.entries)
+    {
+      Coordinate coord(file.path, entry.line, entry.column);
+      auto expected = fresh.resolve(coord);
+      auto actual = engine.resolve(coord);
+      ASSERT_EQ(expected == nullptr, actual == nullptr);
+      if (expected != nullptr)
+      {
+        ASSERT_EQ(*expected, *actual);
+      }
+    }
+  }
+
+  auto resolution = engine.resolve(Coordinate((root / "sample2" / "main.c").string(), 10, 4));
+  ASSERT_EQ((root / "sample2" / "def1.h").string(), resolution->path);
+  ASSERT_EQ(5, resolution->line);
+
+  fs::remove_all(root);
+}
+
+TEST(StackGraphEngine, OverlaysOpenDocuments)
+{
+  auto dir = string("/home/dominik/Code/intellisense/c-language-server/corpus/sample2");
+  auto main_c = dir + "/main.c";
+  StackGraphEngine engine;
+  engine.crossLink(engine.loadDirectoryRecursive(dir, {}));
+  auto on_disk = engine.translation_units.at(main_c)->repr();
+
+  std::ifstream in(main_c);
+  string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+  ASSERT_TRUE(engine.openDocument(main_c, "\n\n" + text));
+  ASSERT_EQ(nullptr, engine.resolve(Coordinate(main_c, 10, 4)));
+  ASSERT_EQ(dir + "/def1.h", engine.resolve(Coordinate(main_c, 12, 4))->path);
+
+  // Scans leave the open document alone.
+  auto delta = engine.loadDirectoryRecursive(dir, {});
+  ASSERT_EQ(3, delta.skipped);
+  ASSERT_EQ(0, delta.removed);
+  ASSERT_EQ(dir + "/def1.h", engine.resolve(Coordinate(main_c, 12, 4))->path);
+
+  ASSERT_TRUE(engine.changeDocument(main_c, {{{0, 0}, {2, 0}, ""},
+                                             {{9, 0}, {9, 0}, "    org.emp.name = \"Ann\";\n"},
+                                             {{9, 4}, {9, 7}, "org2"}}));
+  ASSERT_EQ(dir + "/def1.h", engine.resolve(Coordinate(main_c, 11, 4))->path);
+  ASSERT_EQ(dir + "/def1.h", engine.resolve(Coordinate(main_c, 9, 4))->path);
+
+  StackGraphEngine reparsed;
+  reparsed.crossLink(reparsed.loadDirectoryRecursive(dir, {}));
+  ASSERT_TRUE(reparsed.openDocument(main_c, engine.documents.at(main_c).text));
+  ASSERT_EQ(reparsed.translation_units.at(main_c)->repr(), engine.translation_units.at(main_c)->repr());
+  ASSERT_NE(string::npos, engine.documents.at(main_c).text.find("    org2.emp.name = \"Ann\";\n"));
+
+  // Edits that keep imports and exports only relink the document itself.
+  auto links = engine.cross_links.size();
+  auto linked = engine.translation_units.at(main_c)->repr();
+  engine.crossLink();
+  ASSERT_EQ(links, engine.cross_links.size());
+  ASSERT_EQ(linked, engine.translation_units.at(main_c)->repr());
+
+  ASSERT_TRUE(engine.closeDocument(main_c));
+  ASSERT_EQ(on_disk, engine.translation_units.at(main_c)->repr());
+  ASSERT_EQ(dir + "/def1.h", engine.resolve(Coordinate(main_c, 10, 4))->path);
+
+  // Links from other units follow the definitions into the edited header.
+  auto def1_h = dir + "/def1.h";
+  auto field = engine.resolve(Coordinate(main_c, 10, 4));
+  std::ifstream header(def1_h);
+  ASSERT_TRUE(engine.openDocument(def1_h, string((std::istreambuf_iterator<char>(header)), std::istreambuf_iterator<char>())));
+  ASSERT_TRUE(engine.changeDocument(def1_h, {{{0, 0}, {0, 0}, "\n"}}));
+  ASSERT_EQ(field->line + 1, engine.resolve(Coordinate(main_c, 10, 4))->line);
+  ASSERT_TRUE(engine.closeDocument(def1_h));
+  ASSERT_EQ(*field, *engine.resolve(Coordinate(main_c, 10, 4)));
+
+  auto unsaved = dir + "/unsaved.c";
+  ASSERT_TRUE(engine.openDocument(unsaved, "#include <def2.h>\n\nvoid f(struct Organization o) {\n    o.emp.name = 0;\n}\n"));
+  ASSERT_EQ(dir + "/def1.h", engine.resolve(Coordinate(unsaved, 3, 4))->path);
+  ASSERT_TRUE(engine.closeDocument(unsaved));
+  ASSERT_EQ(4, engine.translation_units.size());
+  ASSERT_FALSE(engine.changeDocument(unsaved, {}));
+}
+
+// Every named scope's usages, found the slow way, against findUsages.
+void _expect_type_usages(StackGraphEngine &engine)
+{
+  size_t links = 0;
+  for (auto &file : engine.node_table.files)
+  {
+    for (auto &entry : file.entries)
+    {
+      stack_graph::NodeRef scope(file.tree, entry.id);
+      if (scope->kind != stack_graph::StackGraphNodeKind::NAMED_SCOPE || scope->location.line == 0)
+      {
+        continue;
+      }
+
+      vector<Coordinate> expected;
+      for (auto &other : engine.node_table.files)
+      {
+        for (auto &e : other.entries)
+        {
+          stack_graph::NodeRef v(other.tree, e.id);
+          if (v->kind == stack_graph::StackGraphNodeKind::SYMBOL && v->jump_to == scope)
+          {
+            expected.push_back(Coordinate(other.path, v->location.line, v->location.column));
+          }
+        }
+      }
+
+      auto found = engine.findUsages(Coordinate(file.path, scope->location.line, scope->location.column));
+      ASSERT_EQ(expected.size(), found.size());
+      for (size_t i = 0; i < expected.size(); i++)
+      {
+        ASSERT_EQ(expected[i], *found[i]);
+      }
+      links += found.size();
+
+      // Every node knows its place among the usages.
+      auto &nodes = engine.usages.find(scope);
+      for (size_t i = 0; i < nodes.size(); i++)
+      {
+        ASSERT_EQ(i, nodes[i]->usage_slot);
+      }
+    }
+  }
+  ASSERT_GT(links, 0);
+}
+
+TEST(StackGraphEngine, KeepsUsageIndexInStep)
+{
+  auto dir = string("/home/dominik/Code/intellisense/c-language-server/corpus/sample2");
+  auto def2_h = dir + "/def2.h";
+  StackGraphEngine engine;
+  engine.crossLink(engine.loadDirectoryRecursive(dir, {}));
+  _expect_type_usages(engine);
+  auto indexed = engine.usages.size();
+
+  std::ifstream in(def2_h);
+  string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+  // A new export relinks the importers; a blank line only moves definitions.
+  ASSERT_TRUE(engine.openDocument(def2_h, "struct Department {\n    struct Employee head;\n};\n" + text));
+  _expect_type_usages(engine);
+  ASSERT_TRUE(engine.changeDocument(def2_h, {{{0, 0}, {0, 0}, "\n"}}));
+  _expect_type_usages(engine);
+  ASSERT_TRUE(engine.closeDocument(def2_h));
+  _expect_type_usages(engine);
+  ASSERT_EQ(indexed, engine.usages.size());
+
+  engine.crossLink();
+  _expect_type_usages(engine);
+  ASSERT_EQ(indexed, engine.usages.size());
+}
+
+TEST(FileWatcher, ReportsChangedSourcesInOneBatch)
+{
+  namespace fs = std::filesystem;
+  auto root = _copy_sample2("c-language-server-watch");
+  auto dir = (root / "sample2").string();
+  StackGraphEngine engine;
+  engine.crossLink(engine.loadDirectoryRecursive(dir, {"/ignored/"}));
+
+  stack_graph::FileWatcher watcher(dir, {"/ignored/"});
+  ASSERT_TRUE(watcher.start());
+
+  std::ofstream((root / "sample2" / "def1.h").string()) << "struct Employee {\n    string name;\n};\n";
+  std::ofstream((root / "sample2" / "notes.txt").string()) << "not a source file";
+  fs::create_directories(root / "sample2" / "sub");
+  std::ofstream((root / "sample2" / "sub" / "extra.c").string()) << "#include <def1.h>\n";
+  fs::create_directories(root / "sample2" / "ignored");
+  std::ofstream((root / "sample2" / "ignored" / "skip.c").string()) << "int x;\n";
+  fs::remove(root / "sample2" / "def2.c");
+
+  std::vector<string> batch;
+  ASSERT_TRUE(watcher.nextBatch(batch, 50));
+  std::vector<string> expected = {dir + "/def1.h", dir + "/def2.c", dir + "/sub"};
+  ASSERT_EQ(expected, batch);
+
+  auto scan = engine.scanPaths(batch, watcher.filter);
+  auto delta = engine.applyScan(scan);
+  ASSERT_EQ(1, delta.reparsed);
+  ASSERT_EQ(1, delta.added);
+  ASSERT_EQ(1, delta.removed);
+  engine.crossLink(delta);
+  ASSERT_NE(nullptr, engine.resolve(Coordinate((root / "sample2" / "main.c").string(), 10, 4)));
+
+  std::thread stopper([&]()
+                      { watcher.stop(); });
+  ASSERT_FALSE(watcher.nextBatch(batch, 50));
+  stopper.join();
+
+  fs::remove_all(root);
+}
+
 TEST(StackGraphEngine, DoesntHoldOnSamsungHeader)
 {
   auto path = "/home/dominik/Code/intellisense/c-language-server/corpus/sample3";
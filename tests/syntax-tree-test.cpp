@@ -2,17 +2,18 @@
 #include <stack-graph-tree.h>
 #include <vector>
 
-using stack_graph::StackGraphNode;
+using stack_graph::NodeRef;
 using stack_graph::StackGraphNodeKind;
+using stack_graph::StackGraphTree;
 using std::vector;
 
 extern "C" TSLanguage *tree_sitter_c();
 
-void _enumerate_nodes(shared_ptr<StackGraphNode> node, vector<shared_ptr<StackGraphNode>> &lst)
+void _enumerate_nodes(NodeRef node, vector<NodeRef> &lst)
 {
   lst.push_back(node);
 
-  for (auto ch : node->children)
+  for (auto ch : node.children())
   {
     _enumerate_nodes(ch, lst);
   }
@@ -70,21 +71,25 @@ protected:
         source_code,
         strlen(source_code));
 
-    TSNode root_node = ts_tree_root_node(tree);
+    root_node = ts_tree_root_node(tree);
+    source = source_code;
 
-    sg_root = stack_graph::build_stack_graph_tree(root_node, source_code);
-    _enumerate_nodes(sg_root, all_nodes);
+    sg_tree = stack_graph::build_stack_graph_tree(root_node, source_code, symbols);
+    _enumerate_nodes(sg_tree->root(), all_nodes);
   }
 
-  shared_ptr<StackGraphNode> sg_root;
-  vector<shared_ptr<StackGraphNode>> all_nodes;
+  stack_graph::StringInterner symbols;
+  TSNode root_node;
+  const char *source;
+  shared_ptr<StackGraphTree> sg_tree;
+  vector<NodeRef> all_nodes;
 };
 
-shared_ptr<StackGraphNode> _find(vector<shared_ptr<StackGraphNode>> nodes, string name, StackGraphNodeKind kind)
+NodeRef _find(vector<NodeRef> nodes, string name, StackGraphNodeKind kind)
 {
   for (auto n : nodes)
   {
-    if (n->kind == kind && n->symbol == name)
+    if (n->kind == kind && n.symbolText() == name)
     {
       return n;
     }
@@ -92,7 +97,7 @@ shared_ptr<StackGraphNode> _find(vector<shared_ptr<StackGraphNode>> nodes, strin
   return nullptr;
 }
 
-bool _contains(vector<shared_ptr<StackGraphNode>> nodes, string name, StackGraphNodeKind kind)
+bool _contains(vector<NodeRef> nodes, string name, StackGraphNodeKind kind)
 {
    return _find(nodes, name, kind) != nullptr;
 }
@@ -133,14 +138,124 @@ TEST_F(StackGraphTest, ContainsAllReferences)
 TEST_F(StackGraphTest, JumpsAreCorrect)
 {
   auto emp_node = _find(all_nodes, "emp", StackGraphNodeKind::SYMBOL);
-  EXPECT_EQ(emp_node->jump_to->symbol, "Employee");
+  EXPECT_EQ(emp_node->jump_to.symbolText(), "Employee");
 
   auto addr_node = _find(all_nodes, "addr", StackGraphNodeKind::SYMBOL);
-  EXPECT_EQ(addr_node->jump_to->symbol, "Address");
+  EXPECT_EQ(addr_node->jump_to.symbolText(), "Address");
 
   auto org_node = _find(all_nodes, "org", StackGraphNodeKind::SYMBOL);
-  EXPECT_EQ(org_node->jump_to->symbol, "Organization");
+  EXPECT_EQ(org_node->jump_to.symbolText(), "Organization");
 }
 
+TEST_F(StackGraphTest, BuildersProduceSameTree)
+{
+  auto recursive = stack_graph::build_stack_graph_tree(root_node, source, symbols, stack_graph::RECURSIVE_BUILDER);
+  EXPECT_EQ(recursive->repr(), sg_tree->repr());
+}
+
+TEST(StackGraphBuilder, HandlesDeepNesting)
+{
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_c());
+
+  string source_code = "int main(){ int x; ";
+  for (int i = 0; i < 50000; i++)
+  {
+    source_code += "{";
+  }
+  source_code += "x = 1;";
+  for (int i = 0; i < 50000; i++)
+  {
+    source_code += "}";
+  }
+  source_code += "}";
+
+  TSTree *tree = ts_parser_parse_string(parser, NULL, source_code.c_str(), source_code.size());
+
+  stack_graph::StringInterner symbols;
+  auto sg_tree = stack_graph::build_stack_graph_tree(ts_tree_root_node(tree), source_code, symbols);
+  // Blocks nested straight into a function body share its scope, so only
+  // root, main, its reference, x and the use of x remain.
+  EXPECT_EQ(5, sg_tree->nodes.size());
+  EXPECT_EQ(StackGraphNodeKind::REFERENCE, sg_tree->nodes.back().kind);
+  EXPECT_EQ("x", symbols.text(sg_tree->nodes.back().symbol));
+
+  ts_tree_delete(tree);
+  ts_parser_delete(parser);
+}
+
+TEST(StackGraphTree, FindsFirstChildInWideScopes)
+{
+  stack_graph::StringInterner symbols;
+  StackGraphTree tree(&symbols);
+  auto root = tree.add(StackGraphNodeKind::NAMED_SCOPE, symbols.intern("file.c"), {0, 0}, stack_graph::NO_NODE);
+  auto narrow = tree.add(StackGraphNodeKind::NAMED_SCOPE, symbols.intern("narrow"), {0, 0}, root);
+  vector<stack_graph::NodeId> first(100, stack_graph::NO_NODE);
+  for (uint32_t i = 0; i < 300; i++)
+  {
+    auto name = symbols.intern("v" + std::to_string(i % 100));
+    auto id = tree.add(StackGraphNodeKind::SYMBOL, name, {i, 0}, root);
+    if (first[i % 100] == stack_graph::NO_NODE)
+    {
+      first[i % 100] = id;
+    }
+  }
+  tree.add(StackGraphNodeKind::SYMBOL, symbols.intern("v7"), {0, 0}, narrow);
+
+  for (int i = 0; i < 100; i++)
+  {
+    EXPECT_EQ(first[i], tree.findChild(root, symbols.find("v" + std::to_string(i))));
+  }
+  EXPECT_EQ(narrow, tree.findChild(root, symbols.find("narrow")));
+  EXPECT_EQ(stack_graph::NO_NODE, tree.findChild(root, symbols.intern("missing")));
+  EXPECT_EQ(1, tree.wide_scopes.size());
+  EXPECT_EQ(stack_graph::NO_NODE, tree.findChild(narrow, symbols.find("v8")));
+  EXPECT_EQ(tree.nodes.size() - 1, tree.findChild(narrow, symbols.find("v7")));
+
+  // Adding a child drops the scope's index, so later lookups see it.
+  auto late = tree.add(StackGraphNodeKind::SYMBOL, symbols.intern("late"), {0, 0}, root);
+  EXPECT_EQ(0, tree.wide_scopes.size());
+  EXPECT_EQ(late, tree.findChild(root, symbols.find("late")));
+}
+
+TEST(StackGraphBuilder, ResolvesTypesInNearestScope)
+{
+  TSParser *parser = ts_parser_new();
+  ts_parser_set_language(parser, tree_sitter_c());
+
+  string source_code = R"raw(
+struct S { int outer; };
+struct S { int second; };
+struct T {
+    struct S { int inner; } x;
+    struct S y;
+};
+void f(struct S a) {
+    struct S b;
+}
+struct S z;
+)raw";
+  TSTree *tree = ts_parser_parse_string(parser, NULL, source_code.c_str(), source_code.size());
 
+  for (auto builder : {stack_graph::CURSOR_BUILDER, stack_graph::RECURSIVE_BUILDER})
+  {
+    stack_graph::StringInterner symbols;
+    auto sg_tree = stack_graph::build_stack_graph_tree(ts_tree_root_node(tree), source_code, symbols, builder);
 
+    // Each `struct S x` adds a symbol S pointing at the definition in the
+    // nearest scope; the first of two definitions in one scope wins.
+    vector<uint32_t> lines;
+    for (auto &node : sg_tree->nodes)
+    {
+      if (node.kind == StackGraphNodeKind::SYMBOL && symbols.text(node.symbol) == "S")
+      {
+        ASSERT_TRUE(node.jump_to != nullptr);
+        lines.push_back(node.jump_to->location.line);
+      }
+    }
+    EXPECT_EQ(vector<uint32_t>({4, 1, 1, 1}), lines);
+  }
+
+  ts_tree_delete(tree);
+  ts_parser_delete(parser);
+}